@@ -26,18 +26,51 @@
 #include "xvasprintf.h"
 
 
+static size_t reallocs = 0;        /* Number of buffer reallocations. */
+static size_t realloc_bytes = 0;   /* Bytes allocated by them. */
+
+static void
+astr_resize (astr as, size_t maxlen)
+{
+  as->maxlen = maxlen;
+  as->text = xrealloc (as->text, as->maxlen + 1);
+  reallocs++;
+  realloc_bytes += as->maxlen + 1;
+}
+
+/*
+ * The buffer grows geometrically, so that appending is amortized
+ * linear, and only shrinks when the string is cut below a quarter of
+ * it, so that alternating insertions and deletions do not reallocate
+ * and the room made by astr_reserve is kept.
+ */
 void
 astr_set_len (astr as, size_t len)
 {
-  if (len > as->maxlen || len < as->maxlen / 2)
-    {
-      as->maxlen = len + ALLOCATION_CHUNK_SIZE;
-      as->text = xrealloc (as->text, as->maxlen + 1);
-    }
+  if (len > as->maxlen)
+    astr_resize (as, MAX (len, as->maxlen + as->maxlen / 2));
+  else if (len < as->len && len < as->maxlen / 4 && as->maxlen > ALLOCATION_CHUNK_SIZE)
+    astr_resize (as, MAX (len * 2, ALLOCATION_CHUNK_SIZE));
   as->len = len;
   as->text[as->len] = '\0';
 }
 
+astr
+astr_reserve (astr as, size_t n)
+{
+  if (n > as->maxlen)
+    astr_resize (as, n);
+  return as;
+}
+
+size_t
+astr_reallocs (size_t *bytes)
+{
+  if (bytes)
+    *bytes = realloc_bytes;
+  return reallocs;
+}
+
 astr astr_new (void)
 {
   astr as;
@@ -197,14 +230,32 @@ astr_readf (const char *filename)
   struct stat st;
   if (stat (filename, &st) == 0)
     {
-      size_t size = st.st_size;
       int fd = open (filename, O_RDONLY);
       if (fd >= 0)
         {
-          char buf[BUFSIZ];
-          as = astr_new ();
-          while ((size = read (fd, buf, BUFSIZ)) > 0)
-            astr_cat_nstr (as, buf, size);
+          /* Read straight into a buffer of the size of the file; only
+             a file growing meanwhile needs any further allocation. */
+          as = astr_reserve (astr_new (), st.st_size);
+          for (;;)
+            {
+              ssize_t n;
+              if (as->len < as->maxlen)
+                {
+                  n = read (fd, as->text + as->len, as->maxlen - as->len);
+                  if (n > 0)
+                    as->len += n;
+                }
+              else
+                {
+                  char buf[BUFSIZ];
+                  n = read (fd, buf, BUFSIZ);
+                  if (n > 0)
+                    astr_cat_nstr (as, buf, n);
+                }
+              if (n <= 0)
+                break;
+            }
+          as->text[as->len] = '\0';
           close (fd);
         }
     }
@@ -328,6 +379,26 @@ main (int argc _GL_UNUSED_PARAMETER, char **argv)
   astr_recase (as1, case_lower);
   assert_eq (as1, "some text");
 
+  size_t before = astr_reallocs (NULL);
+  as1 = astr_new ();
+  for (size_t i = 0; i < 100000; i++)
+    astr_cat_char (as1, 'x');
+  assert (astr_reallocs (NULL) - before < 40);
+
+  before = astr_reallocs (NULL);
+  for (size_t i = 0; i < 1000; i++)
+    {
+      astr_cat_char (as1, 'x');
+      astr_truncate (as1, astr_len (as1) - 1);
+    }
+  assert (astr_reallocs (NULL) == before);
+
+  before = astr_reallocs (NULL);
+  as1 = astr_reserve (astr_new (), 100000);
+  for (size_t i = 0; i < 100000; i++)
+    astr_cat_char (as1, 'x');
+  assert (astr_reallocs (NULL) - before == 1);
+
   printf ("astr test successful.\n");
 
   return EXIT_SUCCESS;
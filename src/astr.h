@@ -69,6 +69,18 @@ typedef struct astr const *const_astr;
 
 void astr_set_len (astr as, size_t len);
 
+/*
+ * Make room for at least `n' characters in `as', so that it can grow
+ * up to that length without reallocating.
+ */
+astr astr_reserve (astr as, size_t n);
+
+/*
+ * Return the number of times a string buffer has been reallocated,
+ * storing the total bytes allocated by them in `bytes' if not NULL.
+ */
+size_t astr_reallocs (size_t *bytes);
+
 
 // Allocate a new string with zero length.
 astr astr_new (void);
@@ -0,0 +1,1058 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <langinfo.h>
+#include <regex.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "buffer.h"
+#include "automaton.h"
+#include "eolscan.h"
+
+/* The size of the blocks of states, and of the hash table of states. */
+#define DFA_BLOCK (64 * 1024)
+#define DFA_SLOTS 4096
+
+/* The cache of states of the DFA of each thread of automaton_scan,
+   which is allocated whole beforehand. */
+#define DFA_THREAD_CACHE (256 * 1024)
+
+typedef uint64_t Set[4];
+
+#define SET_HAS(s, b) (((s)[(b) >> 6] >> ((b) & 63)) & 1)
+#define SET_ADD(s, b) ((s)[(b) >> 6] |= (uint64_t) 1 << ((b) & 63))
+
+/* The context of a position is given by the bytes on either side. */
+#define CTX_NEWLINE 1
+#define CTX_WORD 2
+#define CTX_EDGE 4                      /* The start or end of the buffer. */
+
+enum
+{
+  ASSERT_BOL, ASSERT_EOL, ASSERT_BOB, ASSERT_EOB,
+  ASSERT_WORD_START, ASSERT_WORD_END, ASSERT_WORD_BOUND, ASSERT_NOT_WORD_BOUND
+};
+
+/* The parsed regexp. */
+enum { AST_EMPTY, AST_SET, AST_ASSERT, AST_CAT, AST_ALT, AST_STAR, AST_PLUS, AST_QUEST };
+
+struct ast
+{
+  unsigned char op;
+  int arg;                              /* The set or the assertion. */
+  int left, right;                      /* The operands. */
+};
+
+enum { NFA_SET, NFA_ASSERT, NFA_SPLIT, NFA_MATCH };
+
+struct nfa_node
+{
+  unsigned char op;
+  int arg;                              /* The set or the assertion. */
+  int out, out1;                        /* The next states. */
+};
+
+struct nfa
+{
+  struct nfa_node *nodes;
+  size_t n, alloc;
+  int start;
+};
+
+/*
+ * A state of the DFA is a list of NFA states, those of the matches
+ * that go on through it.  The NFA states past assertions are added
+ * when the next byte is known, which is why a state also records the
+ * context of the byte that led to it.  When looking for the first
+ * match the list is split into groups by the position the matches
+ * started at, earliest first, so that once a match is found the ones
+ * that started later can be dropped.
+ */
+#define SEP (-1)
+
+#define STATE_MATCH 1                   /* A match ended before the byte that led here. */
+#define STATE_MATCHED 2                 /* A match was found: no more are started. */
+#define STATE_DEAD 4                    /* No match goes on from here. */
+#define STATE_IDLE 8                    /* No match is under way. */
+
+struct state
+{
+  struct state *chain;                  /* The next state in its hash slot. */
+  size_t hash;
+  unsigned char flags, ctx;
+  size_t n;
+  int *nodes;
+  struct state *next[];                 /* By byte class, and at the edge of the text. */
+};
+
+/* What a run of a DFA finds. */
+enum
+{
+  RUN_LEFTMOST,                         /* The end of the longest of the first matches. */
+  RUN_EARLIEST,                         /* The first end of a match. */
+  RUN_LONGEST                           /* The end of the longest match from the start. */
+};
+
+struct dfa
+{
+  Automaton ap;
+  struct nfa *nfa;
+  bool reverse;
+  int mode;
+  struct state **table;
+  struct state *idle[CTX_EDGE * 2];     /* The idle state by context. */
+  char **blocks;                        /* The memory for states. */
+  size_t max_blocks, block_size, block, used;
+  int *list, *work, *stack;             /* Scratch space for building states. */
+  unsigned *mark, gen;
+};
+
+enum { DFA_FIRST, DFA_START, DFA_LAST_START, DFA_END, DFA_MAX };
+
+struct Automaton
+{
+  struct ast *ast;
+  size_t nast, ast_alloc;
+  Set *sets;
+  size_t nsets, sets_alloc;
+  int any_mb;                           /* Any UTF-8 multibyte character, or -1. */
+  bool assertions;
+  struct nfa fwd, rev;
+  unsigned char cls[UCHAR_MAX + 1];     /* The class of each byte. */
+  unsigned char rep[UCHAR_MAX + 1];     /* A byte of each class. */
+  unsigned char class_ctx[UCHAR_MAX + 2];
+  size_t nclasses;
+  size_t nfirst;                        /* The bytes that start every match. */
+  char first[2];
+  bool newline;                         /* A match may hold a newline. */
+  struct dfa *dfa[DFA_MAX];
+  struct dfa **threads;                 /* The DFAs of each thread. */
+  size_t nthreads;
+};
+
+struct parser
+{
+  Automaton ap;
+  const unsigned char *p, *end;
+  bool icase, utf8;
+  bool ok;
+};
+
+static int
+new_ast (Automaton ap, int op, int arg, int left, int right)
+{
+  if (ap->nast == ap->ast_alloc)
+    {
+      ap->ast_alloc = 2 * ap->ast_alloc + 16;
+      ap->ast = (struct ast *) xnrealloc (ap->ast, ap->ast_alloc, sizeof (*ap->ast));
+    }
+  ap->ast[ap->nast] = (struct ast) { op, arg, left, right };
+  return ap->nast++;
+}
+
+static int
+new_set (Automaton ap)
+{
+  if (ap->nsets == ap->sets_alloc)
+    {
+      ap->sets_alloc = 2 * ap->sets_alloc + 16;
+      ap->sets = (Set *) xnrealloc (ap->sets, ap->sets_alloc, sizeof (*ap->sets));
+    }
+  memset (ap->sets[ap->nsets], 0, sizeof (Set));
+  return ap->nsets++;
+}
+
+static int
+fail (struct parser *ps)
+{
+  ps->ok = false;
+  return -1;
+}
+
+// Return the node matching the bytes from `lo' to `hi'.
+static int
+range_ast (Automaton ap, int lo, int hi)
+{
+  int set = new_set (ap);
+  for (int b = lo; b <= hi; b++)
+    SET_ADD (ap->sets[set], b);
+  return new_ast (ap, AST_SET, set, -1, -1);
+}
+
+// Return the node matching any UTF-8 character of more than one byte.
+static int
+any_mb (Automaton ap)
+{
+  static const unsigned char seqs[][8] = {
+    { 0xc2, 0xdf, 0x80, 0xbf },
+    { 0xe0, 0xe0, 0xa0, 0xbf, 0x80, 0xbf },
+    { 0xe1, 0xef, 0x80, 0xbf, 0x80, 0xbf },
+    { 0xf0, 0xf0, 0x90, 0xbf, 0x80, 0xbf, 0x80, 0xbf },
+    { 0xf1, 0xf3, 0x80, 0xbf, 0x80, 0xbf, 0x80, 0xbf },
+    { 0xf4, 0xf4, 0x80, 0x8f, 0x80, 0xbf, 0x80, 0xbf },
+  };
+
+  if (ap->any_mb < 0)
+    for (size_t i = 0; i < sizeof (seqs) / sizeof (seqs[0]); i++)
+      {
+        int a = range_ast (ap, seqs[i][0], seqs[i][1]);
+        for (size_t j = 2; j < sizeof (seqs[i]) && seqs[i][j] != 0; j += 2)
+          a = new_ast (ap, AST_CAT, 0, a, range_ast (ap, seqs[i][j], seqs[i][j + 1]));
+        ap->any_mb = ap->any_mb < 0 ? a : new_ast (ap, AST_ALT, 0, ap->any_mb, a);
+      }
+  return ap->any_mb;
+}
+
+/*
+ * Return the node matching the bytes that the regex library matches
+ * with the regexp `s' on their own, which gives the exact meaning of
+ * sets in the locale.  In a multibyte locale only ASCII is tried.
+ */
+static int
+probe_ast (struct parser *ps, const char *s, size_t len)
+{
+  struct re_pattern_buffer pattern;
+  memset (&pattern, 0, sizeof (pattern));
+  re_set_syntax (RE_SYNTAX_EMACS | (ps->icase ? RE_ICASE : 0));
+  if (re_compile_pattern (s, (int) len, &pattern) != NULL)
+    return fail (ps);
+
+  int set = new_set (ps->ap);
+  for (int b = 0; b < (ps->utf8 ? 0x80 : UCHAR_MAX + 1); b++)
+    {
+      char c = (char) b;
+      if (re_match (&pattern, &c, 1, 0, NULL) == 1)
+        SET_ADD (ps->ap->sets[set], b);
+    }
+  regfree (&pattern);
+  return new_ast (ps->ap, AST_SET, set, -1, -1);
+}
+
+// Return the node matching the character at `ps->p', of `len' bytes.
+static int
+char_ast (struct parser *ps, size_t len)
+{
+  Automaton ap = ps->ap;
+  const unsigned char *s = ps->p;
+  ps->p += len;
+
+  if (len == 1)
+    {
+      int set = new_set (ap);
+      for (int b = 0; b < (ps->utf8 ? 0x80 : UCHAR_MAX + 1); b++)
+        if (b == *s || (ps->icase && toupper (b) == toupper (*s)))
+          SET_ADD (ap->sets[set], b);
+      return new_ast (ap, AST_SET, set, -1, -1);
+    }
+
+  int a = range_ast (ap, s[0], s[0]);
+  for (size_t i = 1; i < len; i++)
+    a = new_ast (ap, AST_CAT, 0, a, range_ast (ap, s[i], s[i]));
+  return a;
+}
+
+// Return the length of the UTF-8 character at `s', or 0 if it is not
+// one, or has no automaton.
+static size_t
+char_len (struct parser *ps, const unsigned char *s)
+{
+  if (!ps->utf8 || *s < 0x80)
+    return 1;
+
+  size_t len = *s >= 0xc2 && *s <= 0xdf ? 2 : *s >= 0xe0 && *s <= 0xef ? 3
+    : *s >= 0xf0 && *s <= 0xf4 ? 4 : 0;
+  if (ps->icase || len > (size_t) (ps->end - s))
+    return 0;
+  for (size_t i = 1; i < len; i++)
+    if (s[i] < 0x80 || s[i] > 0xbf)
+      return 0;
+  return len;
+}
+
+static int
+parse_bracket (struct parser *ps)
+{
+  const unsigned char *q = ps->p + 1;
+  if (q < ps->end && *q == '^')
+    q++;
+  if (q < ps->end && *q == ']')
+    q++;
+  for (; q < ps->end && *q != ']'; q++)
+    if ((*q == '[' && q + 1 < ps->end && (q[1] == '.' || q[1] == '='))
+        || (ps->utf8 && *q >= 0x80))
+      return fail (ps);
+  if (q == ps->end)
+    return fail (ps);
+
+  bool negated = ps->p[1] == '^';
+  int a = probe_ast (ps, (const char *) ps->p, q + 1 - ps->p);
+  ps->p = q + 1;
+  if (ps->ok && ps->utf8 && negated)
+    a = new_ast (ps->ap, AST_ALT, 0, a, any_mb (ps->ap));
+  return a;
+}
+
+static bool
+at (struct parser *ps, const unsigned char *p, char c)
+{
+  return ps->end - p >= 2 && p[0] == '\\' && p[1] == c;
+}
+
+static int
+parse_assert (struct parser *ps, int what, size_t len)
+{
+  ps->p += len;
+  ps->ap->assertions = true;
+  return new_ast (ps->ap, AST_ASSERT, what, -1, -1);
+}
+
+static int parse_alt (struct parser *ps);
+
+// Parse a repeated atom.  After an anchor, as at the start of a
+// branch, a repetition operator is an ordinary character.
+static int
+parse_piece (struct parser *ps, bool start, bool *anchor)
+{
+  static const char anchors[] = "`'<>bB";
+  static const int asserts[] = {
+    ASSERT_BOB, ASSERT_EOB, ASSERT_WORD_START, ASSERT_WORD_END,
+    ASSERT_WORD_BOUND, ASSERT_NOT_WORD_BOUND
+  };
+  bool literal_op = start || *anchor;
+  int c = *ps->p, d = ps->p + 1 < ps->end ? ps->p[1] : 0, a;
+  *anchor = false;
+
+  if (literal_op && (c == '*' || c == '+' || c == '?'))
+    a = char_ast (ps, 1);
+  else if (c == '^' && start)
+    {
+      *anchor = true;
+      return parse_assert (ps, ASSERT_BOL, 1);
+    }
+  else if (c == '$' && (ps->p + 1 == ps->end || at (ps, ps->p + 1, ')') || at (ps, ps->p + 1, '|')))
+    {
+      *anchor = true;
+      return parse_assert (ps, ASSERT_EOL, 1);
+    }
+  else if (c == '.')
+    {
+      int set = new_set (ps->ap);
+      for (int b = 0; b < (ps->utf8 ? 0x80 : UCHAR_MAX + 1); b++)
+        if (b != '\n')
+          SET_ADD (ps->ap->sets[set], b);
+      a = new_ast (ps->ap, AST_SET, set, -1, -1);
+      if (ps->utf8)
+        a = new_ast (ps->ap, AST_ALT, 0, a, any_mb (ps->ap));
+      ps->p++;
+    }
+  else if (c == '[')
+    a = parse_bracket (ps);
+  else if (c == '\\' && d != 0 && strchr (anchors, d) != NULL)
+    {
+      /* Word syntax is wider than ASCII in a multibyte locale. */
+      if (ps->utf8 && d != '`' && d != '\'')
+        return fail (ps);
+      *anchor = true;
+      return parse_assert (ps, asserts[strchr (anchors, d) - anchors], 2);
+    }
+  else if (c == '\\' && d == '(')
+    {
+      ps->p += 2;
+      a = parse_alt (ps);
+      if (!ps->ok || !at (ps, ps->p, ')'))
+        return fail (ps);
+      ps->p += 2;
+    }
+  else if (c == '\\' && d != 0 && strchr ("wWsS", d) != NULL)
+    {
+      if (ps->utf8)
+        return fail (ps);
+      a = probe_ast (ps, (const char *) ps->p, 2);
+      ps->p += 2;
+    }
+  else if (c == '\\')
+    {
+      /* Back-references need backtracking. */
+      if (ps->p + 1 == ps->end || (d >= '1' && d <= '9') || (ps->utf8 && d >= 0x80))
+        return fail (ps);
+      ps->p++;
+      a = char_ast (ps, 1);
+    }
+  else
+    {
+      size_t len = char_len (ps, ps->p);
+      if (len == 0)
+        return fail (ps);
+      a = char_ast (ps, len);
+    }
+
+  for (; ps->ok && ps->p < ps->end && strchr ("*+?", *ps->p) != NULL; ps->p++)
+    a = new_ast (ps->ap, *ps->p == '*' ? AST_STAR : *ps->p == '+' ? AST_PLUS : AST_QUEST,
+                 0, a, -1);
+  return a;
+}
+
+static int
+parse_branch (struct parser *ps)
+{
+  int a = new_ast (ps->ap, AST_EMPTY, 0, -1, -1);
+  bool anchor = false;
+  for (bool start = true;
+       ps->ok && ps->p < ps->end && !at (ps, ps->p, '|') && !at (ps, ps->p, ')');
+       start = false)
+    {
+      int b = parse_piece (ps, start, &anchor);
+      a = new_ast (ps->ap, AST_CAT, 0, a, b);
+    }
+  return a;
+}
+
+static int
+parse_alt (struct parser *ps)
+{
+  int a = parse_branch (ps);
+  while (ps->ok && at (ps, ps->p, '|'))
+    {
+      ps->p += 2;
+      int b = parse_branch (ps);
+      a = new_ast (ps->ap, AST_ALT, 0, a, b);
+    }
+  return a;
+}
+
+static int
+nfa_node (struct nfa *nfa, int op, int arg, int out, int out1)
+{
+  if (nfa->n == nfa->alloc)
+    {
+      nfa->alloc = 2 * nfa->alloc + 16;
+      nfa->nodes = (struct nfa_node *) xnrealloc (nfa->nodes, nfa->alloc, sizeof (*nfa->nodes));
+    }
+  nfa->nodes[nfa->n] = (struct nfa_node) { op, arg, out, out1 };
+  return nfa->n++;
+}
+
+// Return the first state of the NFA of `a', going on to `next', or of
+// its reverse if `reverse'.
+static int
+build (Automaton ap, struct nfa *nfa, int a, int next, bool reverse)
+{
+  const struct ast *t = &ap->ast[a];
+  switch (t->op)
+    {
+    case AST_EMPTY:
+      return next;
+    case AST_SET:
+      return nfa_node (nfa, NFA_SET, t->arg, next, -1);
+    case AST_ASSERT:
+      return nfa_node (nfa, NFA_ASSERT, t->arg, next, -1);
+    case AST_CAT:
+      {
+        /* A branch is a long chain of concatenations, so it is
+           flattened rather than followed recursively. */
+        size_t n = 0;
+        for (int b = a; ap->ast[b].op == AST_CAT; b = ap->ast[b].left)
+          n++;
+        int *parts = (int *) XNMALLOC (n + 1, int), b = a;
+        for (size_t i = n; i > 0; b = ap->ast[b].left)
+          parts[i--] = ap->ast[b].right;
+        parts[0] = b;
+        for (size_t i = 0; i <= n; i++)
+          next = build (ap, nfa, parts[reverse ? i : n - i], next, reverse);
+        return next;
+      }
+    case AST_ALT:
+      {
+        int left = build (ap, nfa, t->left, next, reverse);
+        int right = build (ap, nfa, ap->ast[a].right, next, reverse);
+        return nfa_node (nfa, NFA_SPLIT, 0, left, right);
+      }
+    case AST_QUEST:
+      return nfa_node (nfa, NFA_SPLIT, 0, build (ap, nfa, t->left, next, reverse), next);
+    default:
+      {
+        int loop = nfa_node (nfa, NFA_SPLIT, 0, -1, next);
+        int body = build (ap, nfa, ap->ast[a].left, loop, reverse);
+        nfa->nodes[loop].out = body;
+        return ap->ast[a].op == AST_STAR ? loop : body;
+      }
+    }
+}
+
+// Split the bytes into the classes that no set tells apart.
+static void
+make_classes (Automaton ap)
+{
+  Set extra[2];
+  memset (extra, 0, sizeof (extra));
+  for (int b = 0; b <= UCHAR_MAX; b++)
+    {
+      if (b == '\n')
+        SET_ADD (extra[0], b);
+      if ((isalnum (b) || b == '_') && (MB_CUR_MAX == 1 || b < 0x80))
+        SET_ADD (extra[1], b);
+    }
+
+  memset (ap->cls, 0, sizeof (ap->cls));
+  ap->nclasses = 1;
+  for (size_t i = 0; i < ap->nsets + 2; i++)
+    {
+      const uint64_t *set = i < ap->nsets ? ap->sets[i] : extra[i - ap->nsets];
+      int split[2 * (UCHAR_MAX + 1)];
+      size_t n = 0;
+      memset (split, -1, sizeof (split));
+      for (int b = 0; b <= UCHAR_MAX; b++)
+        {
+          int *k = &split[2 * ap->cls[b] + SET_HAS (set, b)];
+          if (*k < 0)
+            *k = n++;
+          ap->cls[b] = *k;
+        }
+      ap->nclasses = n;
+    }
+
+  for (int b = UCHAR_MAX; b >= 0; b--)
+    {
+      ap->rep[ap->cls[b]] = b;
+      ap->class_ctx[ap->cls[b]] = (SET_HAS (extra[0], b) ? CTX_NEWLINE : 0)
+        | (SET_HAS (extra[1], b) ? CTX_WORD : 0);
+    }
+  ap->class_ctx[ap->nclasses] = CTX_EDGE | CTX_NEWLINE;
+}
+
+// Find the bytes that every match starts with, if there are at most
+// two of them.
+static void
+find_first (Automaton ap)
+{
+  const struct nfa *nfa = &ap->fwd;
+  Set first;
+  memset (first, 0, sizeof (first));
+  bool *seen = (bool *) XCALLOC (nfa->n, bool);
+  int *stack = (int *) XNMALLOC (nfa->n, int);
+  size_t sp = 0;
+  stack[sp++] = nfa->start;
+  seen[nfa->start] = true;
+  while (sp > 0)
+    {
+      const struct nfa_node *np = &nfa->nodes[stack[--sp]];
+      if (np->op == NFA_MATCH)
+        return;
+      if (np->op == NFA_SET)
+        for (size_t i = 0; i < 4; i++)
+          first[i] |= ap->sets[np->arg][i];
+      else
+        for (int out = np->out, i = 0; i < 2; out = np->out1, i++)
+          if (out >= 0 && !seen[out] && (i == 0 || np->op == NFA_SPLIT))
+            {
+              seen[out] = true;
+              stack[sp++] = out;
+            }
+    }
+
+  for (int b = 0; b <= UCHAR_MAX; b++)
+    if (SET_HAS (first, b))
+      {
+        if (ap->nfirst == 2)
+          {
+            ap->nfirst = 0;
+            return;
+          }
+        ap->first[ap->nfirst++] = (char) b;
+      }
+  if (ap->nfirst == 1)
+    ap->first[ap->nfirst++] = ap->first[0];
+}
+
+Automaton
+automaton_new (const char *s, size_t len, bool icase)
+{
+  bool utf8 = MB_CUR_MAX > 1;
+  if (utf8 && !STREQ (nl_langinfo (CODESET), "UTF-8"))
+    return NULL;
+
+  Automaton ap = XZALLOC (struct Automaton);
+  ap->any_mb = -1;
+  struct parser ps = {
+    ap, (const unsigned char *) s, (const unsigned char *) s + len, icase, utf8, true
+  };
+  int a = parse_alt (&ps);
+  if (!ps.ok || ps.p != ps.end)
+    return NULL;
+
+  ap->fwd.start = build (ap, &ap->fwd, a, nfa_node (&ap->fwd, NFA_MATCH, 0, -1, -1), false);
+  ap->rev.start = build (ap, &ap->rev, a, nfa_node (&ap->rev, NFA_MATCH, 0, -1, -1), true);
+  make_classes (ap);
+  find_first (ap);
+  for (size_t i = 0; i < ap->fwd.n; i++)
+    if (ap->fwd.nodes[i].op == NFA_SET && SET_HAS (ap->sets[ap->fwd.nodes[i].arg], '\n'))
+      ap->newline = true;
+  return ap;
+}
+
+// Return a new DFA of `ap' for the run `which', with a cache of states
+// of `cache' bytes, allocated now if `whole'.
+static struct dfa *
+new_dfa (Automaton ap, int which, size_t cache, bool whole)
+{
+  struct dfa *d = XZALLOC (struct dfa);
+  d->ap = ap;
+  d->reverse = which == DFA_START || which == DFA_LAST_START;
+  d->nfa = d->reverse ? &ap->rev : &ap->fwd;
+  d->mode = which == DFA_FIRST ? RUN_LEFTMOST : which == DFA_LAST_START ? RUN_EARLIEST : RUN_LONGEST;
+  d->table = (struct state **) XCALLOC (DFA_SLOTS, struct state *);
+
+  /* A block holds several of the largest states. */
+  size_t n = 2 * d->nfa->n + 2;
+  d->block_size = MAX (DFA_BLOCK, 4 * (sizeof (struct state) + (ap->nclasses + 1)
+                                       * sizeof (struct state *) + n * sizeof (int)));
+  d->max_blocks = MAX (cache / d->block_size, 2);
+  d->blocks = (char **) XCALLOC (d->max_blocks, char *);
+  for (size_t i = 0; i < (whole ? d->max_blocks : 1); i++)
+    d->blocks[i] = (char *) xmalloc (d->block_size);
+  d->list = (int *) XNMALLOC (n, int);
+  d->work = (int *) XNMALLOC (n, int);
+  d->stack = (int *) XNMALLOC (n, int);
+  d->mark = (unsigned *) XCALLOC (d->nfa->n, unsigned);
+  return d;
+}
+
+static struct dfa *
+get_dfa (Automaton ap, int which)
+{
+  if (ap->dfa[which] == NULL)
+    ap->dfa[which] = new_dfa (ap, which, AUTOMATON_CACHE, false);
+  return ap->dfa[which];
+}
+
+// Empty the cache of states of `d'.
+static void
+flush (struct dfa *d)
+{
+  memset (d->table, 0, DFA_SLOTS * sizeof (*d->table));
+  memset (d->idle, 0, sizeof (d->idle));
+  d->block = d->used = 0;
+}
+
+// Return the state of `d' with these NFA states, adding it if it is
+// new, and setting `*flushed' if the cache had to be emptied for it.
+static struct state *
+find_state (struct dfa *d, unsigned flags, unsigned ctx, const int *nodes, size_t n,
+            bool *flushed)
+{
+  size_t h = 2166136261u ^ (flags << 8) ^ ctx;
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ (unsigned) nodes[i]) * 16777619u;
+
+  struct state *st;
+  for (st = d->table[h % DFA_SLOTS]; st != NULL; st = st->chain)
+    if (st->hash == h && (st->flags & (STATE_MATCH | STATE_MATCHED)) == flags
+        && st->ctx == ctx && st->n == n
+        && memcmp (st->nodes, nodes, n * sizeof (int)) == 0)
+      return st;
+
+  size_t next_size = (d->ap->nclasses + 1) * sizeof (struct state *);
+  size_t size = (sizeof (struct state) + next_size + n * sizeof (int) + sizeof (void *) - 1)
+    & ~(sizeof (void *) - 1);
+  if (d->used + size > d->block_size)
+    {
+      if (d->block + 1 == d->max_blocks)
+        {
+          flush (d);
+          *flushed = true;
+        }
+      else
+        {
+          if (d->blocks[++d->block] == NULL)
+            d->blocks[d->block] = (char *) xmalloc (d->block_size);
+          d->used = 0;
+        }
+    }
+  st = (struct state *) (d->blocks[d->block] + d->used);
+  d->used += size;
+
+  memset (st, 0, sizeof (struct state) + next_size);
+  st->hash = h;
+  st->flags = flags;
+  if (n == 0 && (d->mode == RUN_LONGEST || (flags & STATE_MATCHED)))
+    st->flags |= STATE_DEAD;
+  if (n == 0 && d->mode == RUN_LEFTMOST && !(flags & STATE_MATCHED))
+    st->flags |= STATE_IDLE;
+  st->ctx = ctx;
+  st->n = n;
+  st->nodes = (int *) ((char *) st->next + next_size);
+  memcpy (st->nodes, nodes, n * sizeof (int));
+  st->chain = d->table[h % DFA_SLOTS];
+  d->table[h % DFA_SLOTS] = st;
+  return st;
+}
+
+static bool
+holds (int what, unsigned before, unsigned after)
+{
+  switch (what)
+    {
+    case ASSERT_BOL:
+      return before & CTX_NEWLINE;
+    case ASSERT_EOL:
+      return after & CTX_NEWLINE;
+    case ASSERT_BOB:
+      return before & CTX_EDGE;
+    case ASSERT_EOB:
+      return after & CTX_EDGE;
+    case ASSERT_WORD_START:
+      return !(before & CTX_WORD) && (after & CTX_WORD);
+    case ASSERT_WORD_END:
+      return (before & CTX_WORD) && !(after & CTX_WORD);
+    case ASSERT_WORD_BOUND:
+      return !(before & CTX_WORD) != !(after & CTX_WORD);
+    default:
+      return !(before & CTX_WORD) == !(after & CTX_WORD);
+    }
+}
+
+/*
+ * Add to `list' at `n' the NFA states reached from `node' without
+ * reading a byte, and return the new length.  Assertions are passed
+ * if they hold between the contexts `before' and `after' when `known',
+ * and otherwise kept in the list.  States already marked are skipped.
+ */
+static size_t
+closure (struct dfa *d, int node, bool known, unsigned before, unsigned after,
+         int *list, size_t n)
+{
+  size_t sp = 0;
+  d->stack[sp++] = node;
+  while (sp > 0)
+    {
+      int i = d->stack[--sp];
+      if (d->mark[i] == d->gen)
+        continue;
+      d->mark[i] = d->gen;
+
+      const struct nfa_node *np = &d->nfa->nodes[i];
+      if (np->op == NFA_SPLIT)
+        {
+          d->stack[sp++] = np->out1;
+          d->stack[sp++] = np->out;
+        }
+      else if (np->op == NFA_ASSERT && known)
+        {
+          if (holds (np->arg, before, after))
+            d->stack[sp++] = np->out;
+        }
+      else
+        list[n++] = i;
+    }
+  return n;
+}
+
+static size_t
+add_sep (int *list, size_t n)
+{
+  if (n > 0 && list[n - 1] != SEP)
+    list[n++] = SEP;
+  return n;
+}
+
+static struct state *
+start_state (struct dfa *d, unsigned ctx)
+{
+  bool flushed = false;
+  if (!d->ap->assertions)
+    ctx = 0;
+  if (d->mode == RUN_LONGEST)
+    return find_state (d, 0, ctx, &d->nfa->start, 1, &flushed);
+  if (d->idle[ctx] == NULL)
+    d->idle[ctx] = find_state (d, 0, ctx, NULL, 0, &flushed);
+  return d->idle[ctx];
+}
+
+// Return the state `st' of `d' goes to on a byte of class `k', or at
+// the edge of the text if `k' is the number of classes.
+static struct state *
+transition (struct dfa *d, struct state *st, size_t k)
+{
+  Automaton ap = d->ap;
+  const struct nfa_node *nodes = d->nfa->nodes;
+  unsigned ctx = ap->class_ctx[k];
+  unsigned before = d->reverse ? ctx : st->ctx, after = d->reverse ? st->ctx : ctx;
+  unsigned flags = st->flags & STATE_MATCHED;
+
+  /* Pass the assertions that hold before this byte. */
+  size_t n = 0;
+  d->gen++;
+  for (size_t i = 0; i < st->n; i++)
+    n = st->nodes[i] == SEP ? add_sep (d->list, n)
+      : closure (d, st->nodes[i], true, before, after, d->list, n);
+  if (d->mode != RUN_LONGEST && !(flags & STATE_MATCHED))
+    {
+      if (d->mode == RUN_LEFTMOST)
+        n = add_sep (d->list, n);
+      n = closure (d, d->nfa->start, true, before, after, d->list, n);
+    }
+
+  /* Drop the matches that started after the first one that ends. */
+  for (size_t i = 0; i < n; i++)
+    if (d->list[i] != SEP && nodes[d->list[i]].op == NFA_MATCH)
+      {
+        flags |= STATE_MATCH;
+        if (d->mode == RUN_LEFTMOST)
+          {
+            flags |= STATE_MATCHED;
+            while (i < n && d->list[i] != SEP)
+              i++;
+            n = i;
+          }
+        break;
+      }
+
+  /* Read the byte. */
+  size_t m = 0;
+  d->gen++;
+  if (k < ap->nclasses)
+    for (size_t i = 0; i < n; i++)
+      {
+        int node = d->list[i];
+        if (node == SEP)
+          m = add_sep (d->work, m);
+        else if (nodes[node].op == NFA_SET && SET_HAS (ap->sets[nodes[node].arg], ap->rep[k]))
+          m = closure (d, nodes[node].out, false, 0, 0, d->work, m);
+      }
+  if (m > 0 && d->work[m - 1] == SEP)
+    m--;
+
+  bool flushed = false;
+  struct state *next = find_state (d, flags, ap->assertions ? ctx : 0, d->work, m, &flushed);
+  if (!flushed)
+    st->next[k] = next;
+  return next;
+}
+
+static unsigned
+byte_ctx (Automaton ap, unsigned char c)
+{
+  return ap->class_ctx[ap->cls[c]];
+}
+
+/* The text a DFA runs over: that of a buffer, or a string. */
+struct text
+{
+  Buffer bp;
+  const char *s;
+  size_t size;
+};
+
+// Return the longest run of `t' that starts at `o', storing its length
+// in `len'.
+static const unsigned char *
+segment (const struct text *t, size_t o, size_t *len)
+{
+  if (t->bp != NULL)
+    return (const unsigned char *) get_buffer_segment (t->bp, o, len);
+  *len = t->size - o;
+  return (const unsigned char *) t->s + o;
+}
+
+// Return the longest run of `t' that ends at `o', as segment.
+static const unsigned char *
+segment_before (const struct text *t, size_t o, size_t *len)
+{
+  if (t->bp != NULL)
+    return (const unsigned char *) get_buffer_segment_before (t->bp, o, len);
+  *len = o;
+  return (const unsigned char *) t->s;
+}
+
+/*
+ * Run `d' over the text `t' from `o' up to `limit', and then on the
+ * context past `limit'.  Return the last position at which a match
+ * ended, or the first one with RUN_EARLIEST, or SIZE_MAX if none did.
+ * With RUN_LEFTMOST, give up at `last' if no match is under way.
+ */
+static size_t
+run_forward (struct dfa *d, const struct text *t, size_t o, size_t last, size_t limit)
+{
+  Automaton ap = d->ap;
+  size_t size = t->size, len, found = SIZE_MAX;
+  const unsigned char *s = segment_before (t, o, &len);
+  struct state *st = start_state (d, o == 0 ? CTX_EDGE | CTX_NEWLINE : byte_ctx (ap, s[len - 1]));
+
+  for (; o < limit; o += len)
+    {
+      s = segment (t, o, &len);
+      len = MIN (len, limit - o);
+      for (size_t i = 0; i < len; i++)
+        {
+          /* With no match under way, give up at `last', or skip to
+             the next byte that can start a match. */
+          if (st->flags & STATE_IDLE)
+            {
+              if (o + i >= last)
+                return found;
+              size_t j = i;
+              if (ap->nfirst > 0)
+                {
+                  size_t stop = MIN (len, last - o);
+                  const char *p = eolscan_find_either ((const char *) s + i, stop - i,
+                                                       ap->first[0], ap->first[1]);
+                  j = p != NULL ? (size_t) ((const unsigned char *) p - s) : stop;
+                }
+              if (j > i)
+                {
+                  st = start_state (d, byte_ctx (ap, s[j - 1]));
+                  if (o + (i = j) >= last)
+                    return found;
+                  if (i == len)
+                    break;
+                }
+            }
+
+          size_t k = ap->cls[s[i]];
+          st = st->next[k] != NULL ? st->next[k] : transition (d, st, k);
+          if (st->flags & (STATE_MATCH | STATE_DEAD))
+            {
+              if (st->flags & STATE_MATCH)
+                found = o + i;
+              if (st->flags & STATE_DEAD)
+                return found;
+            }
+        }
+    }
+
+  size_t k = limit == size ? ap->nclasses : ap->cls[*segment (t, limit, &len)];
+  st = st->next[k] != NULL ? st->next[k] : transition (d, st, k);
+  return st->flags & STATE_MATCH ? limit : found;
+}
+
+// Run `d' backwards from `o' down to `limit', as run_forward.
+static size_t
+run_backward (struct dfa *d, const struct text *t, size_t o, size_t limit)
+{
+  Automaton ap = d->ap;
+  size_t size = t->size, len, found = SIZE_MAX;
+  const unsigned char *s;
+  struct state *st = start_state (d, o == size ? CTX_EDGE | CTX_NEWLINE
+                                  : byte_ctx (ap, *segment (t, o, &len)));
+
+  for (; o > limit; o -= len)
+    {
+      s = segment_before (t, o, &len);
+      s += len - MIN (len, o - limit);
+      len = MIN (len, o - limit);
+      for (size_t i = len; i-- > 0;)
+        {
+          size_t k = ap->cls[s[i]];
+          st = st->next[k] != NULL ? st->next[k] : transition (d, st, k);
+          if (st->flags & (STATE_MATCH | STATE_DEAD))
+            {
+              if (st->flags & STATE_MATCH)
+                {
+                  found = o - len + i + 1;
+                  if (d->mode == RUN_EARLIEST)
+                    return found;
+                }
+              if (st->flags & STATE_DEAD)
+                return found;
+            }
+        }
+    }
+
+  size_t k = ap->nclasses;
+  if (limit > 0)
+    {
+      s = segment_before (t, limit, &len);
+      k = ap->cls[s[len - 1]];
+    }
+  st = st->next[k] != NULL ? st->next[k] : transition (d, st, k);
+  return st->flags & STATE_MATCH ? limit : found;
+}
+
+// Find the first match in `t' at or after `o' that ends by `limit'
+// with the DFAs `first' and `start', giving up at `last' as
+// run_forward.
+static bool
+find_forward (struct dfa *first, struct dfa *start, const struct text *t, size_t o,
+              size_t last, size_t limit, size_t *mstart, size_t *mend)
+{
+  *mend = run_forward (first, t, o, last, limit);
+  if (*mend == SIZE_MAX)
+    return false;
+  *mstart = run_backward (start, t, *mend, o);
+  assert (*mstart != SIZE_MAX);
+  return true;
+}
+
+bool
+automaton_forward (Automaton ap, Buffer bp, size_t o, size_t last, size_t *start, size_t *end)
+{
+  struct text t = { bp, NULL, get_buffer_size (bp) };
+  return find_forward (get_dfa (ap, DFA_FIRST), get_dfa (ap, DFA_START), &t, o, last, t.size,
+                       start, end);
+}
+
+bool
+automaton_backward (Automaton ap, Buffer bp, size_t o, size_t *start, size_t *end)
+{
+  struct text t = { bp, NULL, get_buffer_size (bp) };
+  *start = run_backward (get_dfa (ap, DFA_LAST_START), &t, o, 0);
+  if (*start == SIZE_MAX)
+    return false;
+  *end = run_forward (get_dfa (ap, DFA_END), &t, *start, SIZE_MAX, o);
+  assert (*end != SIZE_MAX);
+  return true;
+}
+
+bool
+automaton_newline (Automaton ap)
+{
+  return ap->newline;
+}
+
+void
+automaton_threads (Automaton ap, size_t n)
+{
+  if (n <= ap->nthreads)
+    return;
+  ap->threads = (struct dfa **) xnrealloc (ap->threads, 2 * n, sizeof (*ap->threads));
+  for (; ap->nthreads < n; ap->nthreads++)
+    {
+      ap->threads[2 * ap->nthreads] = new_dfa (ap, DFA_FIRST, DFA_THREAD_CACHE, true);
+      ap->threads[2 * ap->nthreads + 1] = new_dfa (ap, DFA_START, DFA_THREAD_CACHE, true);
+    }
+}
+
+bool
+automaton_scan (Automaton ap, size_t thread, Buffer bp, size_t o, size_t limit)
+{
+  struct text t = { bp, NULL, get_buffer_size (bp) };
+  return run_forward (ap->threads[2 * thread], &t, o, SIZE_MAX, limit) != SIZE_MAX;
+}
+
+bool
+automaton_find (Automaton ap, size_t thread, Buffer bp, const char *s, size_t len, size_t o,
+                size_t last, size_t limit, size_t *start, size_t *end)
+{
+  struct text t = { bp, s, bp != NULL ? get_buffer_size (bp) : len };
+  return find_forward (ap->threads[2 * thread], ap->threads[2 * thread + 1], &t, o, last, limit,
+                       start, end);
+}
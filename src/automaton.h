@@ -0,0 +1,81 @@
+#ifndef AUTOMATON_H
+#define AUTOMATON_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+
+/*
+ * Matchers for regexps in the syntax of the search commands
+ * (RE_SYNTAX_EMACS), in time linear in the length of the text.  The
+ * regexp is compiled to an NFA, and the text is run through a DFA
+ * whose states are sets of NFA states, built as the text needs them
+ * and kept in a cache of up to AUTOMATON_CACHE bytes, which is emptied
+ * when it fills up.
+ *
+ * As with the regex library, the match found is the longest of those
+ * that start first.  A forward search runs the DFA to find where that
+ * match ends, and then the DFA of the reversed regexp back from there
+ * to find where it starts; a backward search does the opposite.
+ *
+ * Regexps with back-references have no automaton, nor, in a multibyte
+ * locale, those whose meaning there goes beyond their bytes: word
+ * syntax, non-ASCII sets, and non-ASCII characters without case.  Only
+ * UTF-8 is supported among multibyte encodings.
+ *
+ * An automaton is not to be used by several threads at once, except
+ * through automaton_scan and automaton_find, with DFAs for each thread.
+ */
+
+#define AUTOMATON_CACHE (1024 * 1024)
+
+typedef struct Automaton *Automaton;
+
+// Return the automaton of the regexp `s', matched without case if
+// `icase', or NULL if it has none.
+Automaton automaton_new (const char *s, size_t len, bool icase);
+
+// Find the first match at or after `o' in the text of `bp'.  The
+// search may give up at `last' if no match starts before it.
+bool automaton_forward (Automaton ap, Buffer bp, size_t o, size_t last, size_t *start,
+                        size_t *end);
+
+// Find the match that starts last at or before `o' and ends at or
+// before it, in the text of `bp'.
+bool automaton_backward (Automaton ap, Buffer bp, size_t o, size_t *start, size_t *end);
+
+// Return whether a match of `ap' may hold a newline.
+bool automaton_newline (Automaton ap);
+
+// Make the DFAs with which `n' threads may call automaton_scan and
+// automaton_find, which must not allocate.
+void automaton_threads (Automaton ap, size_t n);
+
+// Return whether a match lies between `o' and `limit' in the text of
+// `bp', using the DFAs of `thread'.
+bool automaton_scan (Automaton ap, size_t thread, Buffer bp, size_t o, size_t limit);
+
+// Find the first match at or after `o' that ends by `limit' in the
+// text of `bp', or if it is NULL in `s', of `len' bytes, using the
+// DFAs of `thread', and giving up at `last' as automaton_forward.  If
+// `limit' starts a line, only a match of a regexp that may hold a
+// newline can be cut there.
+bool automaton_find (Automaton ap, size_t thread, Buffer bp, const char *s, size_t len, size_t o,
+                     size_t last, size_t limit, size_t *start, size_t *end);
+
+#endif
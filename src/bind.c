@@ -126,6 +126,17 @@ search_key (Binding tree, gl_list_t keys, size_t from)
   return NULL;
 }
 
+// Return the binding of `keys' in the current buffer, or else the
+// global one.
+static Binding
+find_binding (gl_list_t keys)
+{
+  Binding p = NULL;
+  if (get_buffer_keymap (global.cur_bp) != NULL)
+    p = search_key (get_buffer_keymap (global.cur_bp), keys, 0);
+  return p != NULL ? p : search_key (root_bindings, keys, 0);
+}
+
 size_t
 do_binding_completion (astr as)
 {
@@ -173,7 +184,7 @@ get_key_sequence (void)
   for (;;)
     {
       astr as;
-      Binding p = search_key (root_bindings, keys, 0);
+      Binding p = find_binding (keys);
       if (p == NULL || p->func != NULL)
         break;
       as = keyvectodesc (keys);
@@ -198,7 +209,7 @@ get_function_by_keys (gl_list_t keys)
     }
 
   /* See if we've got a valid key sequence */
-  p = search_key (root_bindings, keys, 0);
+  p = find_binding (keys);
 
   return p ? p->func : NULL;
 }
@@ -297,6 +308,15 @@ init_bindings (void)
   return node_new (10);
 }
 
+// Bind `keystr' to `func' in `bp' only.
+void
+set_buffer_key (Buffer bp, const char *keystr, Function func)
+{
+  if (get_buffer_keymap (bp) == NULL)
+    set_buffer_keymap (bp, init_bindings ());
+  bind_key_vec (get_buffer_keymap (bp), keystrtovec (keystr), 0, func);
+}
+
 void
 init_default_bindings (void)
 {
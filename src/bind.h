@@ -38,6 +38,7 @@ gl_list_t get_key_sequence (void);
 Function get_function_by_keys (gl_list_t keys);
 le *call_command (Function f, int uniarg, bool uniflag, le *branch);
 void get_and_run_command (void);
+void set_buffer_key (Buffer bp, const char *keystr, Function func);
 void init_default_bindings (void);
 
 #endif
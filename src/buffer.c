@@ -21,6 +21,7 @@
 
 #include <config.h>
 
+#include <sys/stat.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,7 +30,6 @@
 
 #include "main.h"
 #include "extern.h"
-#include "memrmem.h"
 
 #include "region.h"
 
@@ -43,6 +43,7 @@
 #include "variables.h"
 #include "file.h"
 #include "minibuf.h"
+#include "occur.h"
 #include "undo.h"
 
 #define FIELD(ty, field)                         \
@@ -65,8 +66,8 @@ realo_to_o (Buffer bp, size_t o)
 {
   if (o == SIZE_MAX)
     return o;
-  else if (o < bp->pt + bp->gap)
-    return MIN (o, bp->pt);
+  else if (o < bp->gap_o + bp->gap)
+    return MIN (o, bp->gap_o);
   else
     return o - bp->gap;
 }
@@ -74,7 +75,42 @@ realo_to_o (Buffer bp, size_t o)
 static inline size_t
 o_to_realo (Buffer bp, size_t o)
 {
-  return o < bp->pt ? o : o + bp->gap;
+  return o < bp->gap_o ? o : o + bp->gap;
+}
+
+/*
+ * Move the gap to offset `o'.  Point moves freely without the gap,
+ * which is only moved when an edit needs it or a caller needs the text
+ * around point to be contiguous.
+ */
+static void
+move_gap (Buffer bp, size_t o)
+{
+  astr as = estr_get_as (bp->text);
+  if (o < bp->gap_o)
+    {
+      astr_move (as, o + bp->gap, o, bp->gap_o - o);
+      astr_set (as, o, '\0', MIN (bp->gap_o - o, bp->gap));
+    }
+  else if (o > bp->gap_o)
+    {
+      astr_move (as, bp->gap_o, bp->gap_o + bp->gap, o - bp->gap_o);
+      astr_set (as, o + bp->gap - MIN (o - bp->gap_o, bp->gap), '\0', MIN (o - bp->gap_o, bp->gap));
+    }
+  bp->gap_o = o;
+}
+
+// Return the offset of an EOL split by the gap, which the estr
+// functions cannot see, or SIZE_MAX.
+static size_t
+gap_split_eol (Buffer bp)
+{
+  const char *eol = get_buffer_eol (bp);
+  if (eol[1] != '\0' && bp->gap > 0 && bp->gap_o > 0 && bp->gap_o < get_buffer_size (bp)
+      && get_buffer_char (bp, bp->gap_o - 1) == eol[0]
+      && get_buffer_char (bp, bp->gap_o) == eol[1])
+    return bp->gap_o - 1;
+  return SIZE_MAX;
 }
 
 // Move the given buffer to head.
@@ -113,6 +149,62 @@ goto_goalc (void)
 }
 
 
+// Replace `del' chars after point with `newlen' chars of `es',
+// returning the number of lines inserted.
+static size_t
+replace_gap (Buffer bp, size_t del, const_estr es, size_t newlen)
+{
+  move_gap (bp, bp->pt);
+
+  /* Adjust gap. */
+  size_t oldgap = bp->gap;
+  size_t added_gap = oldgap + del < newlen ? MIN_GAP : 0;
+  if (added_gap > 0)
+    { /* If gap would vanish, open it to MIN_GAP. */
+      astr_insert (estr_get_as (bp->text), bp->pt, (newlen + MIN_GAP) - (oldgap + del));
+      bp->gap = MIN_GAP;
+    }
+  else if (oldgap + del > MAX_GAP + newlen)
+    { /* If gap would be larger than MAX_GAP, restrict it to MAX_GAP. */
+      astr_remove (estr_get_as (bp->text), bp->pt + newlen + MAX_GAP, (oldgap + del) - (MAX_GAP + newlen));
+      bp->gap = MAX_GAP;
+    }
+  else
+    bp->gap = oldgap + del - newlen;
+
+  /* Zero any new bit of gap not produced by astr_insert. */
+  if (MAX (oldgap, newlen) + added_gap < bp->gap + newlen)
+    astr_set (estr_get_as (bp->text), bp->pt + MAX (oldgap, newlen) + added_gap, '\0', newlen + bp->gap - MAX (oldgap, newlen) - added_gap);
+
+  /* Insert `newlen' chars. */
+  size_t lines = estr_replace_estr_lines (bp->text, bp->pt, es);
+  bp->gap_o = bp->pt + newlen;
+  return lines;
+}
+
+// Replace `del' chars after point with `newlen' chars of `es',
+// returning the number of lines inserted.
+static size_t
+replace_rope (Buffer bp, size_t del, const_estr es, size_t newlen)
+{
+  const char *eol = get_buffer_eol (bp);
+  if (!STREQ (estr_get_eol (es), eol))
+    es = estr_cat (estr_new (astr_new (), eol), es);
+  rope_replace (bp->rope, bp->pt, del, astr_cstr (estr_get_as (es)), newlen);
+  return estr_lines (es);
+}
+
+// Return a copy of `n' chars of the rope `r' from `o'.
+static astr
+rope_substr (Rope r, size_t o, size_t n)
+{
+  astr as = astr_new ();
+  astr_set_len (as, n);
+  rope_copy (r, o, n, as->text);
+  return as;
+}
+
+
 // ========================================================
 
 // Insert the character `c' at point in the current buffer.
@@ -139,7 +231,7 @@ delete_char (void)
 
   if (eolp ())
     {
-      replace_estr (strlen (get_buffer_eol (global.cur_bp)), estr_empty);
+      replace_estr (get_buffer_eol_len (global.cur_bp), estr_empty);
       global.thisflag |= FLAG_NEED_RESYNC;
     }
   else
@@ -150,6 +242,44 @@ delete_char (void)
   return true;
 }
 
+// Record in the journal of `bp' the replacement of `del' chars after
+// point by the `newlen' chars now there, starting the journal if the
+// buffer visits a file and no old journal of it is held.
+static void
+journal_edit (Buffer bp, size_t del, size_t newlen)
+{
+  if (bp->journal == NULL)
+    {
+      if (get_buffer_filename (bp) == NULL || get_buffer_nosave (bp)
+          || !get_variable_bool ("auto-save-default"))
+        return;
+      if (bp->journal_held)
+        {
+          if (exist_file (astr_cstr (journal_name (get_buffer_filename (bp)))))
+            return;
+          bp->journal_held = false;
+        }
+      bp->journal = journal_new (get_buffer_filename (bp), get_buffer_journal_base (bp));
+    }
+  journal_record (bp->journal, bp->pt, del,
+                  estr_get_as (get_buffer_region (bp, region_new (bp->pt, bp->pt + newlen))));
+}
+
+// Replace `del' chars after point with `newlen' chars of `es' in the
+// text, the line index and the journal, leaving point and markers
+// alone; return the number of lines inserted.
+static size_t
+replace_text (Buffer bp, size_t del, const_estr es, size_t newlen)
+{
+  size_t lines = bp->rope ? replace_rope (bp, del, es, newlen) : replace_gap (bp, del, es, newlen);
+  if (bp->lineindex)
+    lineindex_update (bp->lineindex, bp, bp->pt, del, newlen);
+  if (bp->trigrams)
+    trigram_update (bp->trigrams, bp, bp->pt, del, newlen);
+  journal_edit (bp, del, newlen);
+  return lines;
+}
+
 // Replace `del' chars after point with `es'.
 bool
 replace_estr (size_t del, const_estr es)
@@ -160,37 +290,12 @@ replace_estr (size_t del, const_estr es)
   size_t newlen = estr_len (es, get_buffer_eol (global.cur_bp));
   undo_save_block (global.cur_bp->pt, del, newlen);
 
-  /* Adjust gap. */
-  size_t oldgap = global.cur_bp->gap;
-  size_t added_gap = oldgap + del < newlen ? MIN_GAP : 0;
-  if (added_gap > 0)
-    { /* If gap would vanish, open it to MIN_GAP. */
-      astr_insert (estr_get_as (global.cur_bp->text), global.cur_bp->pt, (newlen + MIN_GAP) - (oldgap + del));
-      global.cur_bp->gap = MIN_GAP;
-    }
-  else if (oldgap + del > MAX_GAP + newlen)
-    { /* If gap would be larger than MAX_GAP, restrict it to MAX_GAP. */
-      astr_remove (estr_get_as (global.cur_bp->text), global.cur_bp->pt + newlen + MAX_GAP, (oldgap + del) - (MAX_GAP + newlen));
-      global.cur_bp->gap = MAX_GAP;
-    }
-  else
-    global.cur_bp->gap = oldgap + del - newlen;
-
-  /* Zero any new bit of gap not produced by astr_insert. */
-  if (MAX (oldgap, newlen) + added_gap < global.cur_bp->gap + newlen)
-    astr_set (estr_get_as (global.cur_bp->text), global.cur_bp->pt + MAX (oldgap, newlen) + added_gap, '\0', newlen + global.cur_bp->gap - MAX (oldgap, newlen) - added_gap);
-
-  /* Insert `newlen' chars. */
-  estr_replace_estr (global.cur_bp->text, global.cur_bp->pt, es);
+  size_t lines = replace_text (global.cur_bp, del, es, newlen);
+  adjust_markers (global.cur_bp, global.cur_bp->pt, del, newlen);
   global.cur_bp->pt += newlen;
 
-  /* Adjust markers. */
-  for (Marker m = get_buffer_markers (global.cur_bp); m != NULL; m = get_marker_next (m))
-    if (get_marker_o (m) > global.cur_bp->pt - newlen)
-      set_marker_o (m, MAX (global.cur_bp->pt - newlen, get_marker_o (m) + newlen - del));
-
   set_buffer_modified (global.cur_bp, true);
-  if (estr_next_line (es, 0) != SIZE_MAX)
+  if (lines > 0)
     global.thisflag |= FLAG_NEED_RESYNC;
   return true;
 }
@@ -201,18 +306,117 @@ insert_estr (const_estr es)
   return replace_estr (0, es);
 }
 
+// Append `es', read from the end of the file, to `bp' without
+// recording undo or journal; point stays, unless it was at the end.
+void
+append_buffer_text (Buffer bp, const_estr es)
+{
+  size_t pt = bp->pt, size = get_buffer_size (bp);
+  size_t newlen = estr_len (es, get_buffer_eol (bp));
+  bp->pt = size;
+  if (bp->rope)
+    replace_rope (bp, 0, es, newlen);
+  else
+    replace_gap (bp, 0, es, newlen);
+  if (bp->lineindex)
+    lineindex_update (bp->lineindex, bp, size, 0, newlen);
+  if (bp->trigrams)
+    trigram_update (bp->trigrams, bp, size, 0, newlen);
+  adjust_markers (bp, size, 0, newlen);
+  bp->pt = pt == size ? size + newlen : pt;
+}
+
+Edit
+edit_new (size_t o, size_t del, const_estr es)
+{
+  Edit ep = XZALLOC (struct Edit);
+  *ep = (struct Edit) {.o = o, .del = del, .es = es};
+  return ep;
+}
+
+/*
+ * Apply a batch of edits to the current buffer as a single change: the
+ * edits, sorted by offset and not overlapping, are spliced into one
+ * replacement text, which is written with a single undo record, and
+ * then the markers are adjusted edit by edit.  Point moves like a
+ * marker, except that it goes after the replacement of an edit that
+ * swallows it.
+ */
+bool
+replace_edits (gl_list_t edits)
+{
+  if (warn_if_readonly_buffer ())
+    return false;
+
+  size_t n = gl_list_size (edits);
+  if (n == 0)
+    return true;
+
+  Buffer bp = global.cur_bp;
+  const char *eol = get_buffer_eol (bp);
+  const Edit first = (const Edit) gl_list_get_at (edits, 0);
+  const Edit last = (const Edit) gl_list_get_at (edits, n - 1);
+  size_t start = first->o, end = last->o + last->del;
+
+  /* Splice the replacements and the text between them. */
+  estr es = estr_new (astr_new (), eol);
+  bool newlines = buffer_end_of_line (bp, start) < end;
+  for (size_t i = 0, o = start; i < n; i++)
+    {
+      const Edit ep = (const Edit) gl_list_get_at (edits, i);
+      assert (ep->o >= o);
+      if (ep->o > o)
+        estr_cat (es, get_buffer_region (bp, region_new (o, ep->o)));
+      estr_cat (es, ep->es);
+      o = ep->o + ep->del;
+    }
+  size_t newlen = astr_len (estr_get_as (es));
+
+  undo_save_block (start, end - start, newlen);
+  size_t pt = bp->pt;
+  bp->pt = start;
+  if (replace_text (bp, end - start, es, newlen) > 0)
+    newlines = true;
+
+  /* Adjust markers and point. */
+  size_t delta = 0;
+  bp->pt = pt;
+  for (size_t i = 0; i < n; i++)
+    {
+      const Edit ep = (const Edit) gl_list_get_at (edits, i);
+      size_t len = estr_len (ep->es, eol);
+      adjust_markers (bp, ep->o + delta, ep->del, len);
+      if (ep->o < pt)
+        bp->pt = pt < ep->o + ep->del ? ep->o + delta + len : pt + delta + len - ep->del;
+      delta += len - ep->del;
+    }
+
+  set_buffer_modified (bp, true);
+  if (newlines)
+    global.thisflag |= FLAG_NEED_RESYNC;
+  return true;
+}
+
 // ========================================================
 
 const_astr
 get_buffer_pre_point (Buffer bp)
 {
+  if (bp->rope)
+    return rope_substr (bp->rope, 0, bp->pt);
+  if (bp->gap_o < bp->pt)
+    move_gap (bp, bp->pt);
   return const_astr_new_nstr (astr_cstr (estr_get_as (bp->text)), bp->pt);
 }
 
 const_astr
 get_buffer_post_point (Buffer bp)
 {
-  size_t post_gap = bp->pt + bp->gap;
+  if (bp->rope)
+    return rope_substr (bp->rope, bp->pt, rope_len (bp->rope) - bp->pt);
+  if (bp->gap_o > bp->pt)
+    move_gap (bp, bp->pt);
+  size_t post_gap = o_to_realo (bp, bp->pt);
   const_astr as = estr_get_as (bp->text);
   return const_astr_new_nstr (astr_cstr (as) + post_gap, astr_len (as) - post_gap);
 }
@@ -220,16 +424,6 @@ get_buffer_post_point (Buffer bp)
 void
 set_buffer_pt (Buffer bp, size_t o)
 {
-  if (o < bp->pt)
-    {
-      astr_move (estr_get_as (bp->text), o + bp->gap, o, bp->pt - o);
-      astr_set (estr_get_as (bp->text), o, '\0', MIN (bp->pt - o, bp->gap));
-    }
-  else if (o > bp->pt)
-    {
-      astr_move (estr_get_as (bp->text), bp->pt, bp->pt + bp->gap, o - bp->pt);
-      astr_set (estr_get_as (bp->text), o + bp->gap - MIN (o - bp->pt, bp->gap), '\0', MIN (o - bp->pt, bp->gap));
-    }
   bp->pt = o;
 }
 
@@ -239,37 +433,169 @@ get_buffer_pt (Buffer bp)
   return bp->pt;
 }
 
+/*
+ * Return the longest run of contiguous text starting at `o', storing
+ * its length in `len', or NULL at the end of the buffer.
+ */
+const char *
+get_buffer_segment (Buffer bp, size_t o, size_t *len)
+{
+  if (bp->rope)
+    return rope_segment (bp->rope, o, len);
+
+  const_astr as = estr_get_as (bp->text);
+  *len = o < bp->gap_o ? bp->gap_o - o : astr_len (as) - o_to_realo (bp, o);
+  return *len > 0 ? astr_cstr (as) + o_to_realo (bp, o) : NULL;
+}
+
+/*
+ * Return the longest run of contiguous text ending at `o', storing its
+ * length in `len', or NULL at the start of the buffer.
+ */
+const char *
+get_buffer_segment_before (Buffer bp, size_t o, size_t *len)
+{
+  if (bp->rope)
+    return rope_segment_before (bp->rope, o, len);
+
+  *len = o <= bp->gap_o ? o : o - bp->gap_o;
+  return *len > 0 ? astr_cstr (estr_get_as (bp->text)) + o_to_realo (bp, o - *len) : NULL;
+}
+
+/*
+ * Return the `n' bytes of text at `o' as one string.  If the gap splits
+ * them it is moved to whichever end of them is nearer; the text of a
+ * rope is copied.
+ */
+const char *
+get_buffer_contiguous (Buffer bp, size_t o, size_t n)
+{
+  if (bp->rope)
+    return astr_cstr (rope_substr (bp->rope, o, n));
+
+  if (o < bp->gap_o && bp->gap_o < o + n)
+    move_gap (bp, bp->gap_o - o <= o + n - bp->gap_o ? o : o + n);
+  return astr_cstr (estr_get_as (bp->text)) + o_to_realo (bp, o);
+}
+
+// Replace the whole text of the buffer with `es'.
+void
+set_buffer_text (Buffer bp, estr es)
+{
+  if (bp->rope)
+    rope_release (bp->rope);
+  bp->text = es;
+  bp->rope = NULL;
+  bp->lineindex = NULL;
+  bp->trigrams = NULL;
+  bp->pt = bp->gap_o = bp->gap = 0;
+}
+
+// Replace the whole text of the buffer with the rope `r', taking the
+// EOL type from its first chunk.
+void
+set_buffer_rope_text (Buffer bp, Rope r)
+{
+  size_t len;
+  const char *s = rope_segment (r, 0, &len);
+  set_buffer_text (bp, estr_new (astr_new (), estr_detect_eol (s, len)));
+  bp->rope = r;
+}
+
+// Make the buffers mapping `filename' copy their text, before the file
+// is overwritten.
+void
+unshare_mapped_file (const char *filename)
+{
+  struct stat st;
+  if (stat (filename, &st) == 0)
+    for (Buffer bp = global.head_bp; bp != NULL; bp = bp->next)
+      if (bp->rope && rope_maps (bp->rope, &st))
+        rope_unshare (bp->rope);
+}
+
+// Return whether `bp' maps its file and the file is now shorter than
+// the mapping, so that the text past its end can no longer be read.
+bool
+buffer_mapping_cut (Buffer bp)
+{
+  struct stat st;
+  return bp->rope && get_buffer_filename (bp) != NULL
+    && stat (get_buffer_filename (bp), &st) == 0 && rope_map_cut (bp->rope, &st);
+}
+
+// Switch the buffer storage between a gap buffer and a rope.
+void
+set_buffer_rope (Buffer bp, bool rope)
+{
+  if (rope == (bp->rope != NULL))
+    return;
+
+  if (rope)
+    {
+      size_t pre, post;
+      const char *s = get_buffer_segment (bp, 0, &pre);
+      Rope r = rope_new (s, pre);
+      s = get_buffer_segment (bp, pre, &post);
+      rope_replace (r, pre, 0, s, post);
+      bp->text = estr_new (astr_new (), get_buffer_eol (bp));
+      bp->rope = r;
+    }
+  else
+    {
+      bp->text = estr_new (rope_substr (bp->rope, 0, rope_len (bp->rope)), get_buffer_eol (bp));
+      rope_release (bp->rope);
+      bp->rope = NULL;
+    }
+  bp->gap_o = bp->gap = 0;
+}
+
 //  =======================================================
 
 size_t
 buffer_prev_line (Buffer bp, size_t o)
 {
-  return realo_to_o (bp, estr_prev_line (bp->text, o_to_realo (bp, o)));
+  size_t so = buffer_start_of_line (bp, o);
+  return (so == 0) ? SIZE_MAX : buffer_start_of_line (bp, so - get_buffer_eol_len (bp));
 }
 
 size_t
 buffer_next_line (Buffer bp, size_t o)
 {
-  return realo_to_o (bp, estr_next_line (bp->text, o_to_realo (bp, o)));
+  size_t eo = buffer_end_of_line (bp, o);
+  return (eo == get_buffer_size (bp)) ? SIZE_MAX : eo + get_buffer_eol_len (bp);
 }
 
 size_t
 buffer_start_of_line (Buffer bp, size_t o)
 {
-  return realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, o)));
+  if (bp->rope)
+    {
+      size_t prev = rope_rfind_eol (bp->rope, o, get_buffer_eol (bp));
+      return prev == SIZE_MAX ? 0 : prev + get_buffer_eol_len (bp);
+    }
+  size_t so = realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, o)));
+  size_t split = gap_split_eol (bp);
+  return split != SIZE_MAX && split + 2 <= o && split + 2 > so ? split + 2 : so;
 }
 
 size_t
 buffer_end_of_line (Buffer bp, size_t o)
 {
-  return realo_to_o (bp, estr_end_of_line (bp->text, o_to_realo (bp, o)));
+  if (bp->rope)
+    {
+      size_t next = rope_find_eol (bp->rope, o, get_buffer_eol (bp));
+      return next == SIZE_MAX ? rope_len (bp->rope) : next;
+    }
+  size_t eo = realo_to_o (bp, estr_end_of_line (bp->text, o_to_realo (bp, o)));
+  size_t split = gap_split_eol (bp);
+  return split != SIZE_MAX && split >= o && split < eo ? split : eo;
 }
 
 size_t
 buffer_line_len (Buffer bp, size_t o)
 {
-  return realo_to_o (bp, estr_end_of_line (bp->text, o_to_realo (bp, o))) -
-    realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, o)));
+  return buffer_end_of_line (bp, o) - buffer_start_of_line (bp, o);
 }
 
 // ========================================================
@@ -277,19 +603,23 @@ buffer_line_len (Buffer bp, size_t o)
 size_t
 get_buffer_size (Buffer bp)
 {
+  if (bp->rope)
+    return rope_len (bp->rope);
   return realo_to_o (bp, astr_len (estr_get_as (bp->text)));
 }
 
 char
 get_buffer_char (Buffer bp, size_t o)
 {
+  if (bp->rope)
+    return rope_get (bp->rope, o);
   return astr_get (estr_get_as (bp->text), o_to_realo (bp, o));
 }
 
 size_t
 get_buffer_line_o (Buffer bp)
 {
-  return realo_to_o (bp, estr_start_of_line (bp->text, o_to_realo (bp, bp->pt)));
+  return buffer_start_of_line (bp, bp->pt);
 }
 
 // Buffer methods that don't know about the gap.
@@ -299,17 +629,22 @@ get_buffer_eol (Buffer bp)
   return estr_get_eol (bp->text);
 }
 
+size_t
+get_buffer_eol_len (Buffer bp)
+{
+  return estr_get_eol_len (bp->text);
+}
+
 // Get the buffer region as an estr.
 estr
 get_buffer_region (Buffer bp, Region r)
 {
-  astr as = astr_new ();
-  if (get_region_start (r) < bp->pt)
-    astr_cat (as, astr_substr (get_buffer_pre_point (bp), get_region_start (r), MIN (get_region_end (r), bp->pt) - get_region_start (r)));
-  if (get_region_end (r) > bp->pt)
+  astr as = astr_reserve (astr_new (), get_region_size (r));
+  for (size_t o = get_region_start (r), len; o < get_region_end (r); o += len)
     {
-      size_t from = MAX (get_region_start (r), bp->pt);
-      astr_cat (as, astr_substr (get_buffer_post_point (bp), from - bp->pt, get_region_end (r) - from));
+      const char *s = get_buffer_segment (bp, o, &len);
+      len = MIN (len, get_region_end (r) - o);
+      astr_cat_nstr (as, s, len);
     }
   return estr_new (as, get_buffer_eol (bp));
 }
@@ -351,6 +686,8 @@ destroy_buffer (Buffer bp)
 {
   while (bp->markers)
     unchain_marker (bp->markers);
+  if (bp->rope)
+    rope_release (bp->rope);
 }
 
 void
@@ -578,6 +915,9 @@ kill_buffer (Buffer kill_bp)
         break;
       }
 
+  close_buffer_journal (kill_bp, true);
+  stop_tail (kill_bp);
+  stop_occur (kill_bp);
   destroy_buffer (kill_bp);
 
   /* If no buffers left, recreate scratch buffer and point windows at
@@ -636,6 +976,53 @@ With a nil argument, kill the current buffer.
 }
 END_DEFUN
 
+DEFUN ("toggle-rope-storage", toggle_rope_storage)
+/*+
+Toggle the storage of the current buffer between a gap buffer and a
+rope of chunks.
+A rope makes edits far from the previous one cheap in very large
+buffers; files bigger than `rope-threshold' are visited as ropes.
++*/
+{
+  set_buffer_rope (global.cur_bp, global.cur_bp->rope == NULL);
+}
+END_DEFUN
+
+DEFUN_ARGS ("buffer-index-status", buffer_index_status,
+            BOOL_ARG (build))
+/*+
+Show the size of the trigram index of the current buffer, how much of
+the buffer it covers, and the time spent building it.
+Buffers bigger than `buffer-index-threshold' are indexed while the
+editor waits for keys; with a prefix argument, the index of the
+current buffer is finished first.
++*/
+{
+  BOOL_INIT (build)
+  else
+    build = global.lastflag & FLAG_SET_UNIARG;
+
+  Buffer bp = global.cur_bp;
+  if (build && bp->trigrams == NULL)
+    bp->trigrams = trigram_new ();
+  while (build && trigram_advance (bp->trigrams, bp))
+    ;
+
+  TrigramIndex ti = bp->trigrams;
+  if (ti == NULL)
+    minibuf_write ("The buffer has no index");
+  else
+    {
+      size_t size = get_buffer_size (bp), covered = trigram_covered (ti);
+      minibuf_write ("Index of %zu KB covering %zu%% of the buffer, built in %.3f s%s",
+                     (trigram_bytes (ti) + 1023) / 1024,
+                     size > 0 ? (size_t) ((double) covered / size * 100) : 100,
+                     trigram_seconds (ti),
+                     trigram_stale (ti) > 0 ? "; edited blocks pending" : "");
+    }
+}
+END_DEFUN
+
 Completion
 make_buffer_completion (void)
 {
@@ -687,7 +1074,7 @@ move_char (ptrdiff_t offset)
       else if (dir > 0 ? !eobp () : !bobp ())
         {
           global.thisflag |= FLAG_NEED_RESYNC;
-          set_buffer_pt (global.cur_bp, global.cur_bp->pt + dir * strlen (get_buffer_eol (global.cur_bp)));
+          set_buffer_pt (global.cur_bp, global.cur_bp->pt + dir * get_buffer_eol_len (global.cur_bp));
           if (dir > 0)
             FUNCALL (beginning_of_line);
           else
@@ -703,37 +1090,161 @@ move_char (ptrdiff_t offset)
 bool
 move_line (ptrdiff_t n)
 {
-  size_t (*func) (Buffer bp, size_t o) = buffer_next_line;
-  if (n < 0)
-    {
-      n = -n;
-      func = buffer_prev_line;
-    }
-
   if (last_command () != F_next_line && last_command () != F_previous_line)
     set_buffer_goalc (global.cur_bp, get_goalc ());
 
-  for (; n > 0; n--)
+  /* In large-file mode, step over the lines around point when they
+     are not indexed yet. */
+  if (get_buffer_large (global.cur_bp) && global.cur_bp->pt > get_buffer_loaded (global.cur_bp))
     {
-      size_t o = func (global.cur_bp, global.cur_bp->pt);
-      if (o == SIZE_MAX)
-        break;
+      size_t o = buffer_start_of_line (global.cur_bp, global.cur_bp->pt), next;
+      ptrdiff_t i;
+      for (i = 0; i < labs (n); i++, o = next)
+        if ((next = n < 0 ? buffer_prev_line (global.cur_bp, o)
+             : buffer_next_line (global.cur_bp, o)) == SIZE_MAX)
+          break;
       set_buffer_pt (global.cur_bp, o);
+      goto_goalc ();
+      global.thisflag |= FLAG_NEED_RESYNC;
+      return i == labs (n);
+    }
+
+  /* Only look for the last line when going past it, so that moving
+     around a huge buffer does not index all of it. */
+  size_t line = offset_to_line (global.cur_bp, global.cur_bp->pt);
+  size_t target = n < 0 ? line - MIN (line, (size_t) -n) : line + n;
+  size_t o = line_to_offset (global.cur_bp, target);
+  if (o == SIZE_MAX)
+    {
+      target = offset_to_line (global.cur_bp, get_buffer_size (global.cur_bp));
+      o = line_to_offset (global.cur_bp, target);
     }
+  set_buffer_pt (global.cur_bp, o);
 
   goto_goalc ();
   global.thisflag |= FLAG_NEED_RESYNC;
 
-  return n == 0;
+  return (size_t) labs (n) == (target > line ? target - line : line - target);
 }
 
+// Return the number of the line holding `offset', counting from 0.
 size_t
 offset_to_line (Buffer bp, size_t offset)
 {
-  size_t n = 0;
-  for (size_t o = 0; buffer_end_of_line (bp, o) < offset; o = buffer_next_line (bp, o))
-    n++;
-  return n;
+  if (bp->lineindex == NULL)
+    bp->lineindex = lineindex_new ();
+  return lineindex_line (bp->lineindex, bp, offset);
+}
+
+/*
+ * Return the number of the line holding `offset', or, in large-file
+ * mode when `offset' lies beyond the indexed prefix of the text, an
+ * estimate from the mean length of the lines in the prefix, setting
+ * `*exact' to false.
+ */
+size_t
+estimate_offset_line (Buffer bp, size_t offset, bool *exact)
+{
+  /* Index a first step of the text to sample the length of its lines. */
+  if (get_buffer_large (bp) && get_buffer_loaded (bp) == 0)
+    offset_to_line (bp, 0);
+
+  size_t covered = get_buffer_loaded (bp);
+  *exact = !get_buffer_large (bp) || offset <= covered;
+  if (*exact)
+    return offset_to_line (bp, offset);
+  return (double) offset / covered * offset_to_line (bp, covered);
+}
+
+// Return the size of the prefix of the buffer whose lines are known.
+size_t
+get_buffer_loaded (Buffer bp)
+{
+  return bp->lineindex ? lineindex_covered (bp->lineindex) : 0;
+}
+
+/*
+ * Index one more step of a buffer whose lines are not all known, so
+ * that huge files get read in while the editor waits for keys, or
+ * failing that one more block of the trigrams of a buffer bigger than
+ * `buffer-index-threshold'.  Return false if no buffer needs it.
+ */
+bool
+load_buffers (void)
+{
+  for (Buffer bp = global.head_bp; bp != NULL; bp = bp->next)
+    if (bp->lineindex && lineindex_covered (bp->lineindex) < get_buffer_size (bp))
+      {
+        lineindex_advance (bp->lineindex, bp);
+        return true;
+      }
+
+  for (Buffer bp = global.head_bp; bp != NULL; bp = bp->next)
+    {
+      long threshold;
+      if (bp->trigrams == NULL
+          && lisp_to_number (get_variable_bp (bp, "buffer-index-threshold"), &threshold)
+          && get_buffer_size (bp) > (size_t) MAX (threshold, 0))
+        bp->trigrams = trigram_new ();
+      if (bp->trigrams && trigram_advance (bp->trigrams, bp))
+        return true;
+    }
+  return false;
+}
+
+// Return the trigram index of `bp', or NULL if it has none.
+TrigramIndex
+get_buffer_trigrams (Buffer bp)
+{
+  return bp->trigrams;
+}
+
+// Write out the pending edits of the journal of `bp'; return false if
+// it has no journal or it could not be written.
+bool
+flush_buffer_journal (Buffer bp)
+{
+  return bp->journal && journal_flush (bp->journal);
+}
+
+// Write out the pending edits of every journal, and remove those of
+// buffers that are back to the saved text.
+void
+flush_journals (void)
+{
+  for (Buffer bp = global.head_bp; bp != NULL; bp = bp->next)
+    if (get_buffer_modified (bp))
+      flush_buffer_journal (bp);
+    else
+      close_buffer_journal (bp, true);
+}
+
+// Go on with the held journal of `bp', after its edits are replayed;
+// its first `len' bytes hold whole edits.
+void
+resume_buffer_journal (Buffer bp, size_t len)
+{
+  bp->journal_held = false;
+  bp->journal = journal_resume (get_buffer_filename (bp), len);
+}
+
+// Close the journal of `bp', removing it if `remove' because the
+// edits are saved or discarded.
+void
+close_buffer_journal (Buffer bp, bool remove)
+{
+  if (bp->journal)
+    journal_close (bp->journal, remove);
+  bp->journal = NULL;
+}
+
+// Return the offset of the start of `line', or SIZE_MAX if there is none.
+size_t
+line_to_offset (Buffer bp, size_t line)
+{
+  if (bp->lineindex == NULL)
+    bp->lineindex = lineindex_new ();
+  return lineindex_offset (bp->lineindex, bp, line);
 }
 
 void
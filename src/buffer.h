@@ -28,6 +28,10 @@
 
 #include "region.h"
 #include "marker.h"
+#include "rope.h"
+#include "lineindex.h"
+#include "trigram.h"
+#include "journal.h"
 
 #define BUFFER_FIELDS							\
     /* Dynamically allocated string fields of Buffer. */		\
@@ -52,8 +56,13 @@
     FIELD(bool, autofill)     /* The buffer is in Auto Fill mode. */	\
     FIELD(bool, isearch)      /* The buffer is in Isearch loop. */	\
     FIELD(bool, mark_active)  /* The mark is active. */			\
+    FIELD(bool, large)        /* The buffer is in large-file mode. */	\
+    FIELD(Tail, tail)         /* The state of auto-revert-tail mode, or NULL. */ \
+    FIELD(Binding, keymap)    /* Key bindings of the buffer only, or NULL. */ \
+    FIELD(Occur, occur)       /* The matches listed in an *Occur* buffer. */ \
     FIELD(astr, dir)          /* The default directory. */		\
-    FIELD(estr, text)          /* The default directory. */             \
+    FIELD(astr, journal_base) /* Journal header for the file as last read or written. */ \
+    FIELD(bool, journal_held) /* An old journal of the file waits to be recovered. */ \
 
 #define MIN_GAP 1024 /* Minimum gap size after resize. */
 #define MAX_GAP 4096 /* Maximum permitted gap size. */
@@ -65,8 +74,14 @@ typedef struct Buffer
   BUFFER_FIELDS
 #undef FIELD
 #undef FIELD_STR
+  estr text;         /* The text, or just its EOL type with a rope. */
+  Rope rope;         /* The text when stored as a rope, else NULL. */
+  LineIndex lineindex; /* Index of the lines, built when first needed. */
+  TrigramIndex trigrams; /* Index of the trigrams of a huge buffer, or NULL. */
+  Journal journal;   /* Journal of the edits since the file was saved, or NULL. */
   size_t pt;         /* The point. */
-  size_t gap;        /* Size of gap after point. */
+  size_t gap_o;      /* Offset of the gap, where the last edit happened. */
+  size_t gap;        /* Size of the gap. */
   struct Region overlay; /* The default directory. */
 } *Buffer;
 
@@ -82,15 +97,37 @@ BUFFER_FIELDS
 #undef FIELD
 #undef FIELD_STR
 
+/*
+ * An edit of a batch passed to replace_edits: `del' chars at `o',
+ * counted before any edit of the batch is made, are replaced by `es'.
+ */
+typedef struct Edit
+{
+  size_t o;
+  size_t del;
+  const_estr es;
+} *Edit;
+
 bool insert_char (int c);
 bool delete_char (void);
 bool replace_estr (size_t del, const_estr es);
 bool insert_estr (const_estr as);
+void append_buffer_text (Buffer bp, const_estr es);
+Edit edit_new (size_t o, size_t del, const_estr es);
+bool replace_edits (gl_list_t edits);
 
 const_astr get_buffer_pre_point (Buffer bp);
 const_astr get_buffer_post_point (Buffer bp);
 void set_buffer_pt (Buffer bp, size_t o);
 _GL_ATTRIBUTE_PURE size_t get_buffer_pt (Buffer bp);
+const char *get_buffer_segment (Buffer bp, size_t o, size_t *len);
+const char *get_buffer_segment_before (Buffer bp, size_t o, size_t *len);
+const char *get_buffer_contiguous (Buffer bp, size_t o, size_t n);
+void set_buffer_text (Buffer bp, estr es);
+void set_buffer_rope_text (Buffer bp, Rope r);
+void unshare_mapped_file (const char *filename);
+bool buffer_mapping_cut (Buffer bp);
+void set_buffer_rope (Buffer bp, bool rope);
 
 _GL_ATTRIBUTE_PURE size_t buffer_prev_line (Buffer bp, size_t o);
 _GL_ATTRIBUTE_PURE size_t buffer_next_line (Buffer bp, size_t o);
@@ -102,6 +139,7 @@ _GL_ATTRIBUTE_PURE size_t get_buffer_size (Buffer bp);
 _GL_ATTRIBUTE_PURE char get_buffer_char (Buffer bp, size_t o);
 _GL_ATTRIBUTE_PURE size_t get_buffer_line_o (Buffer bp);
 _GL_ATTRIBUTE_PURE const char *get_buffer_eol (Buffer bp);
+_GL_ATTRIBUTE_PURE size_t get_buffer_eol_len (Buffer bp);
 
 Buffer buffer_new (void);
 void init_buffer (Buffer bp);
@@ -130,7 +168,16 @@ void kill_buffer (Buffer kill_bp);
 bool check_modified_buffer (Buffer bp);
 bool move_char (ptrdiff_t dir);
 bool move_line (ptrdiff_t n);
-_GL_ATTRIBUTE_PURE size_t offset_to_line (Buffer bp, size_t offset);
+size_t offset_to_line (Buffer bp, size_t offset);
+size_t estimate_offset_line (Buffer bp, size_t offset, bool *exact);
+size_t line_to_offset (Buffer bp, size_t line);
+_GL_ATTRIBUTE_PURE size_t get_buffer_loaded (Buffer bp);
+bool load_buffers (void);
+_GL_ATTRIBUTE_PURE TrigramIndex get_buffer_trigrams (Buffer bp);
+bool flush_buffer_journal (Buffer bp);
+void flush_journals (void);
+void close_buffer_journal (Buffer bp, bool remove);
+void resume_buffer_journal (Buffer bp, size_t len);
 void goto_offset (size_t o);
 
 void write_temp_buffer (const char *name, bool show, void (*func) (va_list ap), ...);
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "eolscan.h"
+
+#if defined __GNUC__ && defined __SSE2__ && (defined __x86_64__ || defined __i386__)
+# define EOLSCAN_SSE2 1
+# include <immintrin.h>
+# if __GNUC__ >= 5 || defined __clang__
+#  define EOLSCAN_AVX2 1
+# endif
+#endif
+
+/*
+ * Every kernel takes the EOL as its first byte `a' and its second
+ * byte `b', which is '\0' for one-byte EOLs; the pair kernels look for
+ * `a' followed by `b'.
+ */
+struct kernels
+{
+  const char *name;
+  size_t (*count) (const char *s, size_t len, char a, char b);
+  const char *(*find) (const char *s, size_t len, char a, char b);
+  const char *(*find_any) (const char *s, size_t len, char a, char b);
+  const char *(*rfind) (const char *s, size_t len, char a, char b);
+  size_t (*copy) (char *dest, const char *s, size_t len, char a, char b);
+};
+
+// ================ Portable kernels =======================
+
+static size_t
+count_generic (const char *s, size_t len, char a, char b)
+{
+  size_t n = 0;
+  if (b == '\0')
+    for (size_t i = 0; i < len; i++)
+      n += s[i] == a;
+  else
+    for (size_t i = 0; i + 1 < len; i++)
+      n += s[i] == a && s[i + 1] == b;
+  return n;
+}
+
+static const char *
+find_generic (const char *s, size_t len, char a, char b)
+{
+  for (const char *p = s; (p = memchr (p, a, len - (p - s))) != NULL; p++)
+    if (b == '\0' || (p + 1 < s + len && p[1] == b))
+      return p;
+  return NULL;
+}
+
+static const char *
+find_any_generic (const char *s, size_t len, char a, char b)
+{
+  for (size_t i = 0; i < len; i++)
+    if (s[i] == a || s[i] == b)
+      return s + i;
+  return NULL;
+}
+
+static const char *
+rfind_generic (const char *s, size_t len, char a, char b)
+{
+  if (b == '\0')
+    {
+      for (size_t i = len; i > 0; i--)
+        if (s[i - 1] == a)
+          return s + i - 1;
+    }
+  else
+    for (size_t i = len; i > 1; i--)
+      if (s[i - 2] == a && s[i - 1] == b)
+        return s + i - 2;
+  return NULL;
+}
+
+static size_t
+copy_generic (char *dest, const char *s, size_t len, char a, char b)
+{
+  memcpy (dest, s, len);
+  return count_generic (s, len, a, b);
+}
+
+static const struct kernels generic_kernels = {
+  "generic", count_generic, find_generic, find_any_generic, rfind_generic, copy_generic
+};
+
+// ================ Vector kernels =========================
+
+/*
+ * The vector kernels are written once for a vector type V of W bytes
+ * and instantiated for SSE2 and AVX2.  MASK (p, c) is the bit mask of
+ * the bytes of the vector at `p' equal to the splatted `c'.  Pair
+ * masks also load the vector at `p + 1', so the loops stop one byte
+ * earlier and leave the tail to the portable kernels; the backward
+ * scan leaves them the head instead.
+ */
+#define DEFINE_KERNELS(isa, attr, V, W, MASK, SPLAT, STORE)		\
+									\
+  attr static size_t							\
+  count_ ## isa (const char *s, size_t len, char a, char b)		\
+  {									\
+    V va = SPLAT (a), vb = SPLAT (b);					\
+    size_t i = 0, n = 0, stop = b == '\0' ? W : W + 1;			\
+    for (; i + stop <= len; i += W)					\
+      {									\
+        unsigned m = MASK (s + i, va);					\
+        if (b != '\0')							\
+          m &= MASK (s + i + 1, vb);					\
+        n += __builtin_popcount (m);					\
+      }									\
+    return n + count_generic (s + i, len - i, a, b);			\
+  }									\
+									\
+  attr static const char *						\
+  find_ ## isa (const char *s, size_t len, char a, char b)		\
+  {									\
+    V va = SPLAT (a), vb = SPLAT (b);					\
+    size_t i = 0, stop = b == '\0' ? W : W + 1;				\
+    for (; i + stop <= len; i += W)					\
+      {									\
+        unsigned m = MASK (s + i, va);					\
+        if (b != '\0')							\
+          m &= MASK (s + i + 1, vb);					\
+        if (m != 0)							\
+          return s + i + __builtin_ctz (m);				\
+      }									\
+    return find_generic (s + i, len - i, a, b);				\
+  }									\
+									\
+  attr static const char *						\
+  find_any_ ## isa (const char *s, size_t len, char a, char b)		\
+  {									\
+    V va = SPLAT (a), vb = SPLAT (b);					\
+    size_t i = 0;							\
+    for (; i + W <= len; i += W)					\
+      {									\
+        unsigned m = MASK (s + i, va) | MASK (s + i, vb);		\
+        if (m != 0)							\
+          return s + i + __builtin_ctz (m);				\
+      }									\
+    return find_any_generic (s + i, len - i, a, b);			\
+  }									\
+									\
+  attr static const char *						\
+  rfind_ ## isa (const char *s, size_t len, char a, char b)		\
+  {									\
+    V va = SPLAT (a), vb = SPLAT (b);					\
+    size_t end = len, stop = b == '\0' ? W : W + 1;			\
+    for (; end >= stop; end -= W)					\
+      {									\
+        const char *p = s + end - stop;					\
+        unsigned m = MASK (p, va);					\
+        if (b != '\0')							\
+          m &= MASK (p + 1, vb);					\
+        if (m != 0)							\
+          return p + (31 - __builtin_clz (m));				\
+      }									\
+    return rfind_generic (s, end, a, b);				\
+  }									\
+									\
+  attr static size_t							\
+  copy_ ## isa (char *dest, const char *s, size_t len, char a, char b)	\
+  {									\
+    V va = SPLAT (a), vb = SPLAT (b);					\
+    size_t i = 0, n = 0, stop = b == '\0' ? W : W + 1;			\
+    for (; i + stop <= len; i += W)					\
+      {									\
+        STORE (dest + i, s + i);					\
+        unsigned m = MASK (s + i, va);					\
+        if (b != '\0')							\
+          m &= MASK (s + i + 1, vb);					\
+        n += __builtin_popcount (m);					\
+      }									\
+    return n + copy_generic (dest + i, s + i, len - i, a, b);		\
+  }									\
+									\
+  static const struct kernels isa ## _kernels = {			\
+    #isa, count_ ## isa, find_ ## isa, find_any_ ## isa, rfind_ ## isa,	\
+    copy_ ## isa							\
+  };
+
+#ifdef EOLSCAN_SSE2
+#define SSE2_MASK(p, v)							\
+  ((unsigned) _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (p)), v)))
+#define SSE2_STORE(d, p)						\
+  _mm_storeu_si128 ((__m128i *) (d), _mm_loadu_si128 ((const __m128i *) (p)))
+
+DEFINE_KERNELS (sse2, , __m128i, 16, SSE2_MASK, _mm_set1_epi8, SSE2_STORE)
+#endif
+
+#ifdef EOLSCAN_AVX2
+#define AVX2_MASK(p, v)							\
+  ((unsigned) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (p)), v)))
+#define AVX2_STORE(d, p)						\
+  _mm256_storeu_si256 ((__m256i *) (d), _mm256_loadu_si256 ((const __m256i *) (p)))
+
+DEFINE_KERNELS (avx2, __attribute__ ((target ("avx2,popcnt"))), __m256i, 32,
+                AVX2_MASK, _mm256_set1_epi8, AVX2_STORE)
+#endif
+
+// ================ Dispatch ===============================
+
+static const struct kernels *
+kernels (void)
+{
+  static const struct kernels *k = NULL;
+  if (k == NULL)
+    {
+      k = &generic_kernels;
+#ifdef EOLSCAN_SSE2
+      k = &sse2_kernels;
+#endif
+#ifdef EOLSCAN_AVX2
+      __builtin_cpu_init ();
+      if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("popcnt"))
+        k = &avx2_kernels;
+#endif
+    }
+  return k;
+}
+
+size_t
+eolscan_count (const char *s, size_t len, const char *eol)
+{
+  return kernels ()->count (s, len, eol[0], eol[1]);
+}
+
+const char *
+eolscan_find (const char *s, size_t len, const char *eol)
+{
+  return kernels ()->find (s, len, eol[0], eol[1]);
+}
+
+const char *
+eolscan_find_any (const char *s, size_t len)
+{
+  return kernels ()->find_any (s, len, '\n', '\r');
+}
+
+const char *
+eolscan_find_either (const char *s, size_t len, char a, char b)
+{
+  return kernels ()->find_any (s, len, a, b);
+}
+
+const char *
+eolscan_rfind (const char *s, size_t len, const char *eol)
+{
+  return kernels ()->rfind (s, len, eol[0], eol[1]);
+}
+
+size_t
+eolscan_copy (char *dest, const char *s, size_t len, const char *eol)
+{
+  if (dest < s + len && s < dest + len)
+    {
+      memmove (dest, s, len);
+      return eolscan_count (dest, len, eol);
+    }
+  return kernels ()->copy (dest, s, len, eol[0], eol[1]);
+}
+
+const char *
+eolscan_isa (void)
+{
+  return kernels ()->name;
+}
@@ -0,0 +1,54 @@
+#ifndef EOLSCAN_H
+#define EOLSCAN_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+/*
+ * Scanning kernels for line ends.  An EOL is one of the coding_eol_*
+ * strings, of one or two bytes.  The kernels compare a whole vector
+ * of bytes at a time with SSE2 or AVX2 when the processor has them,
+ * which is checked once at run time, and fall back to portable loops
+ * otherwise.
+ */
+
+// Return the number of EOLs in `s'.
+_GL_ATTRIBUTE_PURE size_t eolscan_count (const char *s, size_t len, const char *eol);
+
+// Return the first EOL in `s', or NULL.
+_GL_ATTRIBUTE_PURE const char *eolscan_find (const char *s, size_t len, const char *eol);
+
+// Return the last EOL lying entirely in `s', or NULL.
+_GL_ATTRIBUTE_PURE const char *eolscan_rfind (const char *s, size_t len, const char *eol);
+
+// Return the first LF or CR in `s', or NULL.
+_GL_ATTRIBUTE_PURE const char *eolscan_find_any (const char *s, size_t len);
+
+// Return the first `a' or `b' in `s', or NULL.  This is the kernel of
+// eolscan_find_any for any two bytes.
+_GL_ATTRIBUTE_PURE const char *eolscan_find_either (const char *s, size_t len, char a, char b);
+
+// Copy `s' to `dest', returning the number of EOLs copied.  The
+// strings may overlap.
+size_t eolscan_copy (char *dest, const char *s, size_t len, const char *eol);
+
+// Return the name of the kernels in use.
+const char *eolscan_isa (void);
+
+#endif
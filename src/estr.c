@@ -21,6 +21,7 @@
 
 #include <config.h>
 
+#include <assert.h>
 #include <stdbool.h>
 #include <string.h>
 #include "xalloc.h"
@@ -28,7 +29,7 @@
 
 #include "astr.h"
 #include "estr.h"
-#include "memrmem.h"
+#include "eolscan.h"
 
 estr estr_empty;
 
@@ -49,6 +50,7 @@ estr_new (const_astr as, const char *eol)
   estr es = XZALLOC (struct estr);
   es->as = astr_cpy (astr_new (), as);
   es->eol = eol;
+  es->eol_len = strlen (eol);
   return es;
 }
 
@@ -64,73 +66,75 @@ estr_get_eol (const_estr es)
   return es->eol;
 }
 
+size_t
+estr_get_eol_len (const_estr es)
+{
+  return es->eol_len;
+}
+
 /* Maximum number of EOLs to check before deciding type. */
 #define MAX_EOL_CHECK_COUNT 3
-estr
-estr_new_astr (const_astr as)
+const char *
+estr_detect_eol (const char *s, size_t len)
 {
-  bool first_eol = true;
+  const char *eol = coding_eol_lf, *end = s + len;
   size_t total_eols = 0;
-  estr es = estr_new (as, coding_eol_lf);
-  for (size_t i = 0; i < astr_len (as) && total_eols < MAX_EOL_CHECK_COUNT; i++)
+  for (const char *p = s;
+       total_eols < MAX_EOL_CHECK_COUNT && (p = eolscan_find_any (p, end - p)) != NULL;
+       p++)
     {
-      char c = astr_get (as, i);
-      if (c == '\n' || c == '\r')
+      const char *this_eol_type;
+      if (*p == '\n')
+        this_eol_type = coding_eol_lf;
+      else if (p == end - 1 || p[1] != '\n')
+        this_eol_type = coding_eol_cr;
+      else
         {
-          const char *this_eol_type;
-          total_eols++;
-          if (c == '\n')
-            this_eol_type = coding_eol_lf;
-          else if (i == astr_len (as) - 1 || astr_get (as, i + 1) != '\n')
-            this_eol_type = coding_eol_cr;
-          else
-            {
-              this_eol_type = coding_eol_crlf;
-              i++;
-            }
-
-          if (first_eol)
-            { /* This is the first end-of-line. */
-              es->eol = this_eol_type;
-              first_eol = false;
-            }
-          else if (es->eol != this_eol_type)
-            { /* This EOL is different from the last; arbitrarily choose LF. */
-              es->eol = coding_eol_lf;
-              break;
-            }
+          this_eol_type = coding_eol_crlf;
+          p++;
         }
+
+      if (total_eols++ == 0)
+        /* This is the first end-of-line. */
+        eol = this_eol_type;
+      else if (eol != this_eol_type)
+        /* This EOL is different from the last; arbitrarily choose LF. */
+        return coding_eol_lf;
     }
-  return es;
+  return eol;
+}
+
+estr
+estr_new_astr (const_astr as)
+{
+  return estr_new (as, estr_detect_eol (astr_cstr (as), astr_len (as)));
 }
 
 size_t
 estr_prev_line (const_estr es, size_t o)
 {
   size_t so = estr_start_of_line (es, o);
-  return (so == 0) ? SIZE_MAX : estr_start_of_line (es, so - strlen (es->eol));
+  return (so == 0) ? SIZE_MAX : estr_start_of_line (es, so - es->eol_len);
 }
 
 size_t
 estr_next_line (const_estr es, size_t o)
 {
   size_t eo = estr_end_of_line (es, o);
-  return (eo == astr_len (es->as)) ? SIZE_MAX : eo + strlen (es->eol);
+  return (eo == astr_len (es->as)) ? SIZE_MAX : eo + es->eol_len;
 }
 
 size_t
 estr_start_of_line (const_estr es, size_t o)
 {
-  size_t eol_len = strlen (es->eol);
-  const char *prev = memrmem (astr_cstr (es->as), o, es->eol, eol_len);
-  return prev ? prev - astr_cstr (es->as) + eol_len : 0;
+  const char *prev = eolscan_rfind (astr_cstr (es->as), o, es->eol);
+  return prev ? prev - astr_cstr (es->as) + es->eol_len : 0;
 }
 
 size_t
 estr_end_of_line (const_estr es, size_t o)
 {
-  const char *next = memmem (astr_cstr (es->as) + o, astr_len (es->as) - o,
-                             es->eol, strlen (es->eol));
+  const char *next = eolscan_find (astr_cstr (es->as) + o, astr_len (es->as) - o, es->eol);
   return next ? (size_t) (next - astr_cstr (es->as)) : astr_len (es->as);
 }
 
@@ -143,24 +147,35 @@ estr_line_len (const_estr es, size_t o)
 size_t
 estr_lines (const_estr es)
 {
-  size_t es_eol_len = strlen (es->eol);
-  const char *s = astr_cstr (es->as), *next;
-  size_t lines = 0;
-  for (size_t len = astr_len (es->as);
-       (next = memmem (s, len, es->eol, es_eol_len)) != NULL;
-       lines++, len -= (size_t) (next - s) + es_eol_len, s = next + es_eol_len)
-    ;
-  return lines;
+  return eolscan_count (astr_cstr (es->as), astr_len (es->as), es->eol);
 }
 
-estr
-estr_replace_estr (estr es, size_t pos, const_estr src)
+size_t
+estr_len (const_estr es, const char *eol_type)
+{
+  size_t len = astr_len (es->as), eol_len = strlen (eol_type);
+  return eol_len == es->eol_len ? len : len + estr_lines (es) * (eol_len - es->eol_len);
+}
+
+/*
+ * Copy `src' into `es' at `pos', converting its EOLs to those of `es',
+ * in a single pass that also counts them; return the count.
+ */
+size_t
+estr_replace_estr_lines (estr es, size_t pos, const_estr src)
 {
   const char *s = astr_cstr (src->as);
-  size_t src_eol_len = strlen (src->eol), es_eol_len = strlen (es->eol);
-  for (size_t len = astr_len (src->as); len > 0;)
+  size_t len = astr_len (src->as);
+  if (strcmp (src->eol, es->eol) == 0)
+    {
+      assert (pos + len <= astr_len (es->as));
+      return eolscan_copy (es->as->text + pos, s, len, es->eol);
+    }
+
+  size_t lines = 0;
+  while (len > 0)
     {
-      const char *next = memmem (s, len, src->eol, src_eol_len);
+      const char *next = eolscan_find (s, len, src->eol);
       size_t line_len = next ? (size_t) (next - s) : len;
       astr_replace_nstr (es->as, pos, s, line_len);
       pos += line_len;
@@ -168,12 +183,20 @@ estr_replace_estr (estr es, size_t pos, const_estr src)
       s = next;
       if (len > 0)
         {
-          astr_replace_nstr (es->as, pos, es->eol, es_eol_len);
-          s += src_eol_len;
-          len -= src_eol_len;
-          pos += es_eol_len;
+          astr_replace_nstr (es->as, pos, es->eol, es->eol_len);
+          s += src->eol_len;
+          len -= src->eol_len;
+          pos += es->eol_len;
+          lines++;
         }
     }
+  return lines;
+}
+
+estr
+estr_replace_estr (estr es, size_t pos, const_estr src)
+{
+  estr_replace_estr_lines (es, pos, src);
   return es;
 }
 
@@ -185,9 +208,21 @@ estr_cat (estr es, const_estr src)
   return estr_replace_estr (es, oldlen, src);
 }
 
+estr
+estr_take (astr as, const char *eol)
+{
+  estr es = estr_new (astr_new (), eol);
+  es->as = as;
+  return es;
+}
+
 estr
 estr_readf (const char *filename)
 {
   astr as = astr_readf (filename);
-  return as ? estr_new_astr (as) : NULL;
+  if (as == NULL)
+    return NULL;
+
+  /* Keep the string just read instead of copying it. */
+  return estr_take (as, estr_detect_eol (astr_cstr (as), astr_len (as)));
 }
@@ -28,6 +28,7 @@ typedef struct estr
 {
   astr as;			/* String. */
   const char *eol;		/* EOL type. */
+  size_t eol_len;		/* Length of the EOL. */
 } *estr;
 
 typedef struct estr const *const_estr;
@@ -41,10 +42,16 @@ extern const char *coding_eol_cr;
 void estr_init (void);
 _GL_ATTRIBUTE_PURE astr estr_get_as (const_estr es);
 _GL_ATTRIBUTE_PURE const char *estr_get_eol (const_estr es);
+_GL_ATTRIBUTE_PURE size_t estr_get_eol_len (const_estr es);
 
 estr estr_new (const_astr as, const char *eol);
+/* Make estr from `as' itself rather than a copy of it. */
+estr estr_take (astr as, const char *eol);
 const_estr const_estr_new (const_astr as, const char *eol);
 
+/* Return the EOL type of the text `s'. */
+_GL_ATTRIBUTE_PURE const char *estr_detect_eol (const char *s, size_t len);
+
 /* Make estr from astr, determining EOL type from astr's contents. */
 estr estr_new_astr (const_astr as);
 
@@ -54,10 +61,12 @@ _GL_ATTRIBUTE_PURE size_t estr_start_of_line (const_estr es, size_t o);
 _GL_ATTRIBUTE_PURE size_t estr_end_of_line (const_estr es, size_t o);
 _GL_ATTRIBUTE_PURE size_t estr_line_len (const_estr es, size_t o);
 _GL_ATTRIBUTE_PURE size_t estr_lines (const_estr es);
+size_t estr_replace_estr_lines (estr es, size_t pos, const_estr src);
 estr estr_replace_estr (estr es, size_t pos, const_estr src);
 estr estr_cat (estr es, const_estr src);
 
-#define estr_len(es, eol_type) (astr_len (estr_get_as (es)) +  estr_lines (es) * (strlen (eol_type) - strlen (estr_get_eol (es))))
+// Return the length of `es' once converted to `eol_type' EOLs.
+_GL_ATTRIBUTE_PURE size_t estr_len (const_estr es, const char *eol_type);
 
 /* Read file contents into an estr.
  * The `as' member is NULL if the file doesn't exist, or other error. */
@@ -70,6 +70,9 @@ void recenter (Window wp);
 
 /* search.c --------------------------------------------------------------- */
 void init_search (void);
+size_t regex_cache_hits (size_t *misses);
+bool no_upper (const char *s, size_t len, int regex);
+size_t regex_prefix_len (const char *n, size_t nsize);
 
 /* term_curses.c ---------------------------------------------------------- */
 
@@ -22,9 +22,15 @@
 #include <config.h>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
 #include <limits.h>
+#include <poll.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +39,7 @@
 #include "dirname.h"
 #include "xgetcwd.h"
 #include "copy-file.h"
+#include "gl_array_list.h"
 
 #include "main.h"
 #include "extern.h"
@@ -44,6 +51,8 @@
 #include "getkey.h"
 #include "minibuf.h"
 #include "undo.h"
+#include "marker.h"
+#include "preload.h"
 #include "astr.h"
 
 bool
@@ -209,8 +218,71 @@ check_writable (const char *filename)
   return euidaccess (filename, W_OK) >= 0;
 }
 
+// Return true if `size' exceeds the number of bytes in variable `var',
+// which may be nil.
+static bool
+exceeds_threshold (off_t size, const char *var)
+{
+  long threshold;
+  return lisp_to_number (get_variable (var), &threshold) && size > MAX (threshold, 0);
+}
+
+/*
+ * Read `filename' into `bp', mapping it into memory if `map' or if it
+ * is larger than `map-threshold', and else into a rope if it is larger
+ * than `rope-threshold'.  A buffer in auto-revert-tail mode is never
+ * mapped, as its file may be truncated under the mapping.  The file is
+ * described as it was before reading as the base of the journal of the
+ * buffer.  Return false if it could not be read, leaving the buffer
+ * empty.
+ */
+static bool
+read_file_text (Buffer bp, const char *filename, bool map)
+{
+  struct stat st;
+  bool found = stat (filename, &st) == 0;
+  bool large = found && exceeds_threshold (st.st_size, "rope-threshold");
+  map = map || (found && exceeds_threshold (st.st_size, "map-threshold"));
+  set_buffer_journal_base (bp, journal_header (found ? &st : NULL));
+
+  Rope r = map && get_buffer_tail (bp) == NULL ? rope_new_mapped (filename) : NULL;
+  if (r)
+    {
+      set_buffer_rope_text (bp, r);
+      return true;
+    }
+
+  estr es = preload_take (filename);
+  if (es == NULL)
+    es = estr_readf (filename);
+  set_buffer_text (bp, es ? es : estr_new_astr (astr_new ()));
+  if (large)
+    set_buffer_rope (bp, true);
+  return es != NULL;
+}
+
+/*
+ * Start reading `filenames', which are about to be visited in turn, in
+ * parallel.  Files that will be visited as ropes are left alone, to be
+ * read or mapped when they are visited.
+ */
+void
+preload_visits (gl_list_t filenames)
+{
+  long threshold;
+  if (!lisp_to_number (get_variable ("rope-threshold"), &threshold))
+    threshold = LONG_MAX;
+  preload_files (filenames, MAX (threshold, 0));
+}
+
+/*
+ * Visit `filename'.  A file visited read-only, or larger than
+ * `map-threshold', is mapped into memory rather than read; a file
+ * larger than `large-file-threshold' is visited in large-file mode.
+ */
+
 bool
-find_file (const char *filename)
+find_file (const char *filename, bool readonly)
 {
   Buffer bp;
   for (bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
@@ -231,17 +303,24 @@ find_file (const char *filename)
           set_buffer_names (bp, filename);
           set_buffer_dir (bp, astr_new_cstr (dir_name (filename)));
 
-          estr es = estr_readf (filename);
-          if (es)
-            set_buffer_readonly (bp, !check_writable (filename));
-          else
-            es = estr_new_astr (astr_new ());
-          set_buffer_text (bp, es);
+          struct stat st;
+          set_buffer_large (bp, stat (filename, &st) == 0
+                            && exceeds_threshold (st.st_size, "large-file-threshold"));
+          if (read_file_text (bp, filename, readonly))
+            set_buffer_readonly (bp, readonly || !check_writable (filename));
 
           /* Reset undo history. */
           set_buffer_next_undop (bp, NULL);
           set_buffer_last_undop (bp, NULL);
           set_buffer_modified (bp, false);
+
+          /* Keep an old journal until it is recovered. */
+          if (exist_file (astr_cstr (journal_name (get_buffer_filename (bp)))))
+            {
+              set_buffer_journal_held (bp, true);
+              minibuf_write ("%s has a journal; use M-x recover-file to replay it",
+                             get_buffer_name (bp));
+            }
         }
     }
 
@@ -256,6 +335,8 @@ DEFUN_ARGS ("find-file", find_file,
 Edit file @i{filename}.
 Switch to a buffer visiting file @i{filename},
 creating one if none already exists.
+If @i{filename} contains wildcards and `find-file-wildcards' is
+non-nil, visit all the files that match it, reading them in parallel.
 +*/
 {
   STR_INIT (filename)
@@ -272,23 +353,151 @@ creating one if none already exists.
     ok = leNIL;
 
   if (ok != leNIL)
-    ok = bool_to_lisp (find_file (astr_cstr (filename)));
+    {
+      glob_t g;
+      if (get_variable_bool ("find-file-wildcards")
+          && strpbrk (astr_cstr (filename), "*?[") != NULL
+          && !exist_file (astr_cstr (filename))
+          && glob (astr_cstr (filename), 0, NULL, &g) == 0)
+        {
+          gl_list_t matches = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+          for (size_t i = 0; i < g.gl_pathc; i++)
+            {
+              astr as = astr_new_cstr (g.gl_pathv[i]);
+              expand_path (as);
+              gl_list_add_last (matches, astr_cstr (as));
+            }
+          globfree (&g);
+
+          /* Visit the matches last to first, leaving the first current. */
+          preload_visits (matches);
+          for (size_t i = gl_list_size (matches); ok != leNIL && i > 0; i--)
+            ok = bool_to_lisp (find_file (gl_list_get_at (matches, i - 1), false));
+        }
+      else
+        ok = bool_to_lisp (find_file (astr_cstr (filename), false));
+    }
 }
 END_DEFUN
 
-DEFUN ("find-file-read-only", find_file_read_only)
+DEFUN_ARGS ("find-file-read-only", find_file_read_only,
+            STR_ARG (filename))
 /*+
 Edit file @i{filename} but don't allow changes.
 Like `find-file' but marks buffer as read-only.
+The file is mapped into memory, so that even huge files open at once;
+only the parts that are edited get copied.  It must not be rewritten
+or truncated by other programs while it is visited.
 Use @kbd{M-x toggle-read-only} to permit editing.
 +*/
 {
-  ok = F_find_file (uniarg, is_uniarg, arglist);
+  STR_INIT (filename)
+  else
+    {
+      filename = minibuf_read_filename ("Find file read-only: ",
+                                        astr_cstr (get_buffer_dir (global.cur_bp)), NULL);
+
+      if (filename == NULL)
+        ok = FUNCALL (keyboard_quit);
+    }
+
+  if (filename == NULL || astr_len (filename) == 0)
+    ok = leNIL;
+
+  if (ok != leNIL)
+    ok = bool_to_lisp (find_file (astr_cstr (filename), true));
   if (ok == leT)
     set_buffer_readonly (global.cur_bp, true);
 }
 END_DEFUN
 
+/*
+ * Visit `filename' afresh and replay the edits in its journal.  A
+ * buffer already visiting the file is killed first, after writing out
+ * its journal, so that its edits are replayed too.  The journal is
+ * held while they are, and only then gone on with, so that it is
+ * whole if the editor dies meanwhile.
+ */
+static bool
+recover_file (const char *filename)
+{
+  astr name = astr_new_cstr (filename);
+  if (filename[0] != '/')
+    name = astr_fmt ("%s/%s", astr_cstr (agetcwd ()), filename);
+  filename = astr_cstr (name);
+
+  for (Buffer bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
+    if (get_buffer_filename (bp) != NULL &&
+        STREQ (get_buffer_filename (bp), filename))
+      {
+        if (!flush_buffer_journal (bp) && !check_modified_buffer (bp))
+          return false;
+        close_buffer_journal (bp, false);
+        kill_buffer (bp);
+        break;
+      }
+
+  if (!find_file (filename, false))
+    return false;
+
+  Buffer bp = global.cur_bp;
+  size_t len;
+  gl_list_t edits = journal_read (filename, get_buffer_eol (bp), &len);
+  if (edits == NULL)
+    {
+      if (errno == ENOENT)
+        minibuf_error ("%s has no journal", filename);
+      else
+        minibuf_error ("The journal of %s does not match the file", filename);
+      return false;
+    }
+
+  size_t n = gl_list_size (edits);
+  for (size_t i = 0; i < n; i++)
+    {
+      const Edit ep = (const Edit) gl_list_get_at (edits, i);
+      if (ep->o + ep->del > get_buffer_size (bp))
+        {
+          minibuf_error ("The journal of %s is corrupt", filename);
+          return false;
+        }
+      set_buffer_pt (bp, ep->o);
+      if (!replace_estr (ep->del, ep->es))
+        return false;
+    }
+  resume_buffer_journal (bp, len);
+  global.thisflag |= FLAG_NEED_RESYNC;
+  minibuf_write ("Replayed %zu edits of %s", n, filename);
+  return true;
+}
+
+DEFUN_ARGS ("recover-file", recover_file,
+            STR_ARG (filename))
+/*+
+Visit file @i{filename}, but get contents from its journal.
+The journal, @samp{#@i{file}.journal#} in the directory of the file,
+records the edits made since the file was last saved, unless
+`auto-save-default' is @samp{nil}; they are replayed onto the file.
++*/
+{
+  STR_INIT (filename)
+  else
+    {
+      filename = minibuf_read_filename ("Recover file: ",
+                                        astr_cstr (get_buffer_dir (global.cur_bp)), NULL);
+
+      if (filename == NULL)
+        ok = FUNCALL (keyboard_quit);
+    }
+
+  if (filename == NULL || astr_len (filename) == 0)
+    ok = leNIL;
+
+  if (ok != leNIL)
+    ok = bool_to_lisp (recover_file (astr_cstr (filename)));
+}
+END_DEFUN
+
 DEFUN ("find-alternate-file", find_alternate_file)
 /*+
 Find the file specified by the user, select its buffer, kill previous buffer.
@@ -311,11 +520,250 @@ If the current buffer now contains an empty file that you just visited
   else if (astr_len (ms) > 0 && check_modified_buffer (global.cur_bp))
     {
       kill_buffer (global.cur_bp);
-      ok = bool_to_lisp (find_file (astr_cstr (ms)));
+      ok = bool_to_lisp (find_file (astr_cstr (ms), false));
     }
 }
 END_DEFUN
 
+/*
+ * Auto-revert-tail mode.  The file of a buffer in the mode is watched
+ * with inotify, and so is its directory, to see the file replaced.
+ * While the editor waits for keys, the bytes appended to the file
+ * since it was last looked at are read and appended to the buffer; a
+ * file that shrank or was replaced, as when a log is rotated, is read
+ * again in full.
+ */
+struct Tail
+{
+  int wd, dir_wd;    /* Watches of the file and of its directory, or -1. */
+  size_t size;       /* Size of the part of the file in the buffer. */
+  dev_t dev;         /* Device and inode of the file in the buffer. */
+  ino_t ino;
+};
+
+static size_t tails;      /* Number of buffers in the mode. */
+
+#ifdef HAVE_INOTIFY
+static int tail_fd = -1;  /* The inotify instance, or -1. */
+
+// Remove the watch `wd' unless the buffer of another tail uses it.
+static void
+unwatch (int wd)
+{
+  for (Buffer bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
+    {
+      Tail tp = get_buffer_tail (bp);
+      if (tp && (tp->wd == wd || tp->dir_wd == wd))
+        return;
+    }
+  inotify_rm_watch (tail_fd, wd);
+}
+
+// Watch the file of `bp' as it is now.
+static void
+watch_tail (Buffer bp)
+{
+  Tail tp = get_buffer_tail (bp);
+  int wd = inotify_add_watch (tail_fd, get_buffer_filename (bp),
+                              IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (tp->wd >= 0 && tp->wd != wd)
+    {
+      int old = tp->wd;
+      tp->wd = -1;
+      unwatch (old);
+    }
+  tp->wd = wd;
+}
+
+// Read the whole file of `bp', found to be `st', again.
+static void
+reload_tail (Buffer bp, const struct stat *st)
+{
+  Tail tp = get_buffer_tail (bp);
+  size_t size = get_buffer_size (bp), pt = get_buffer_pt (bp);
+
+  adjust_markers (bp, 0, size, 0);
+  read_file_text (bp, get_buffer_filename (bp), get_buffer_readonly (bp));
+  set_buffer_pt (bp, pt == size ? get_buffer_size (bp) : MIN (pt, get_buffer_size (bp)));
+  set_buffer_next_undop (bp, NULL);
+  set_buffer_last_undop (bp, NULL);
+  close_buffer_journal (bp, true);
+
+  tp->size = get_buffer_size (bp);
+  tp->dev = st->st_dev;
+  tp->ino = st->st_ino;
+  watch_tail (bp);
+}
+
+// Append to `bp' the bytes appended to its file, found to be `st'.
+static void
+read_tail (Buffer bp, const struct stat *st)
+{
+  size_t st_size = st->st_size;
+  Tail tp = get_buffer_tail (bp);
+  int fd = open (get_buffer_filename (bp), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  astr as = astr_reserve (astr_new (), st_size - tp->size);
+  size_t len = 0;
+  while (len < st_size - tp->size)
+    {
+      ssize_t n = pread (fd, as->text + len, st_size - tp->size - len, tp->size + len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      len += n;
+    }
+  close (fd);
+  astr_set_len (as, len);
+
+  if (len > 0)
+    {
+      append_buffer_text (bp, estr_new (as, get_buffer_eol (bp)));
+      tp->size += len;
+    }
+  if (tp->size == st_size)
+    set_buffer_journal_base (bp, journal_header (st));
+}
+
+// Bring `bp' up to date with its file, unless it is modified.
+static void
+follow_tail (Buffer bp)
+{
+  Tail tp = get_buffer_tail (bp);
+  struct stat st;
+  if (get_buffer_modified (bp) || stat (get_buffer_filename (bp), &st) != 0)
+    return;
+
+  if (st.st_dev != tp->dev || st.st_ino != tp->ino || (size_t) st.st_size < tp->size)
+    reload_tail (bp, &st);
+  else if ((size_t) st.st_size > tp->size)
+    read_tail (bp, &st);
+  else
+    return;
+
+  if (bp == global.cur_bp)
+    global.thisflag |= FLAG_NEED_RESYNC;
+}
+#endif
+
+// Put `bp' in auto-revert-tail mode.
+static bool
+start_tail (Buffer bp)
+{
+  const char *filename = get_buffer_filename (bp);
+  if (filename == NULL)
+    {
+      minibuf_error ("Buffer does not visit a file");
+      return false;
+    }
+
+#ifdef HAVE_INOTIFY
+  if (tail_fd < 0 && (tail_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    {
+      minibuf_error ("%s", strerror (errno));
+      return false;
+    }
+
+  Tail tp = XZALLOC (struct Tail);
+  tp->wd = tp->dir_wd = -1;
+  tp->size = get_buffer_size (bp);
+  set_buffer_tail (bp, tp);
+  tails++;
+
+  /* A log may be truncated when it is rotated, which would fault on
+     a mapping of it. */
+  unshare_mapped_file (filename);
+
+  struct stat st;
+  if (stat (filename, &st) == 0)
+    {
+      tp->dev = st.st_dev;
+      tp->ino = st.st_ino;
+      watch_tail (bp);
+    }
+  tp->dir_wd = inotify_add_watch (tail_fd, dir_name (filename), IN_CREATE | IN_MOVED_TO);
+
+  follow_tail (bp);
+  return true;
+#else
+  minibuf_error ("Auto-revert-tail mode is not supported on this system");
+  return false;
+#endif
+}
+
+// Take `bp' out of auto-revert-tail mode.
+void
+stop_tail (Buffer bp)
+{
+  Tail tp = get_buffer_tail (bp);
+  if (tp == NULL)
+    return;
+
+  set_buffer_tail (bp, NULL);
+  tails--;
+#ifdef HAVE_INOTIFY
+  if (tp->wd >= 0)
+    unwatch (tp->wd);
+  if (tp->dir_wd >= 0)
+    unwatch (tp->dir_wd);
+#endif
+}
+
+/*
+ * Wait for a key or for a change to the files of the buffers in
+ * auto-revert-tail mode, and bring them up to date.  Return false when
+ * a key is ready, or at once if no buffer is in the mode.
+ */
+bool
+follow_tails (void)
+{
+#ifdef HAVE_INOTIFY
+  if (tails == 0)
+    return false;
+
+  struct pollfd fds[2] = {
+    { .fd = STDIN_FILENO, .events = POLLIN },
+    { .fd = tail_fd, .events = POLLIN },
+  };
+  if (poll (fds, 2, -1) < 0)
+    return errno == EINTR;
+  if (!(fds[1].revents & POLLIN))
+    return false;
+
+  /* Every buffer in the mode is checked, so the events themselves are
+     not needed. */
+  char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  while (read (tail_fd, buf, sizeof buf) > 0)
+    ;
+  for (Buffer bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
+    if (get_buffer_tail (bp))
+      follow_tail (bp);
+  return true;
+#else
+  return false;
+#endif
+}
+
+DEFUN ("auto-revert-tail-mode", auto_revert_tail_mode)
+/*+
+Toggle auto-revert-tail mode in the current buffer.
+In this mode the buffer follows its file as it grows: text appended to
+the file is appended to the buffer, and point moves with it only when
+it is at the end.  If the file shrinks or is replaced, as when a log is
+rotated, it is read again in full.  The buffer is not updated while it
+is modified.
++*/
+{
+  if (get_buffer_tail (global.cur_bp))
+    stop_tail (global.cur_bp);
+  else
+    ok = bool_to_lisp (start_tail (global.cur_bp));
+}
+END_DEFUN
+
 DEFUN_ARGS ("switch-to-buffer", switch_to_buffer,
             STR_ARG (buf))
 /*+
@@ -440,35 +888,164 @@ Set mark after the inserted text.
 }
 END_DEFUN
 
+#define SAVE_IOVECS 64  /* Segments written by each writev call. */
+
 /*
- * Write buffer to given file name with given mode.
+ * A file being saved.  The text is written to a temporary file in the
+ * same directory, which is then renamed over the target, so that a
+ * crash never leaves a truncated file; when the temporary file cannot
+ * be made, or could not keep the owner of the target, the target is
+ * overwritten in place instead.
  */
+struct save
+{
+  char target[PATH_MAX];  /* The file, through any symbolic links. */
+  char *tmp;              /* The temporary file, or NULL in place. */
+  int fd;                 /* The file written. */
+  mode_t mode;            /* Mode of a new file. */
+};
+
+static void
+save_open (struct save *sv, const char *filename, mode_t mode)
+{
+  struct stat st;
+  bool exists = stat (filename, &st) == 0;
+  if (!exists || realpath (filename, sv->target) == NULL)
+    snprintf (sv->target, sizeof sv->target, "%s", filename);
+  sv->mode = mode;
+
+  sv->tmp = xasprintf ("%s/.%s.XXXXXX", dir_name (sv->target), base_name (sv->target));
+  sv->fd = mkstemp (sv->tmp);
+  if (sv->fd >= 0)
+    {
+      mode_t mask = umask (0);
+      umask (mask);
+      if (fchmod (sv->fd, exists ? st.st_mode & 07777 : mode & ~mask) == 0
+          && (!exists || (st.st_uid == geteuid () && st.st_gid == getegid ())
+              || fchown (sv->fd, st.st_uid, st.st_gid) == 0))
+        return;
+      close (sv->fd);
+      unlink (sv->tmp);
+    }
+  sv->tmp = NULL;
+  sv->fd = -1;
+}
+
+// Write the whole buffer to `fd', resuming after short writes.
 static int
-write_to_disk (Buffer bp, const char *filename, mode_t mode)
+write_segments (Buffer bp, int fd)
 {
-  int fd = creat (filename, mode);
-  if (fd < 0)
-    return -1;
+  struct iovec iov[SAVE_IOVECS];
+  for (size_t o = 0, size = get_buffer_size (bp); o < size; )
+    {
+      int n = 0;
+      size_t len;
+      for (size_t p = o; p < size && n < SAVE_IOVECS; p += len, n++)
+        {
+          iov[n].iov_base = (char *) get_buffer_segment (bp, p, &len);
+          iov[n].iov_len = len;
+        }
 
-  int ret = 0;
-  const_astr as = get_buffer_pre_point (bp);
-  ssize_t written = write (fd, astr_cstr (as), astr_len (as));
-  if (written < 0 || (size_t) written != astr_len (as))
-    ret = written;
-  else
+      ssize_t written = writev (fd, iov, n);
+      if (written < 0 && errno != EINTR)
+        return -1;
+      if (written > 0)
+        o += written;
+    }
+  return 0;
+}
+
+static int
+save_commit (struct save *sv, Buffer bp)
+{
+  if (sv->tmp == NULL)
     {
-      as = get_buffer_post_point (bp);
-      written = write (fd, astr_cstr (as), astr_len (as));
-      if (written < 0 || (size_t) written != astr_len (as))
-        ret = written;
+      unshare_mapped_file (sv->target);
+      sv->fd = creat (sv->target, sv->mode);
+      if (sv->fd < 0)
+        return -1;
     }
 
-  if (close (fd) < 0 && ret == 0)
+  int ret = write_segments (bp, sv->fd);
+  if (ret == 0 && !get_variable_bool ("write-region-inhibit-fsync")
+      && fdatasync (sv->fd) < 0)
+    ret = -1;
+  if (close (sv->fd) < 0 && ret == 0)
     ret = -1;
 
+  if (sv->tmp)
+    {
+      if (ret == 0 && rename (sv->tmp, sv->target) < 0)
+        ret = -1;
+      if (ret < 0)
+        {
+          int err = errno;
+          unlink (sv->tmp);
+          errno = err;
+        }
+    }
   return ret;
 }
 
+/*
+ * Write buffer to given file name with given mode.
+ */
+static int
+write_to_disk (Buffer bp, const char *filename, mode_t mode)
+{
+  struct save sv;
+  save_open (&sv, filename, mode);
+  return save_commit (&sv, bp);
+}
+
+/*
+ * Copy `filename' to `backup', preserving its mode and times, with
+ * copy_file_range when available so that the kernel may share the
+ * blocks instead of copying them.
+ */
+static int
+copy_backup (const char *filename, const char *backup)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  struct stat st;
+  int in = open (filename, O_RDONLY), out = -1;
+  if (in >= 0 && fstat (in, &st) == 0)
+    out = open (backup, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+  if (out >= 0)
+    {
+      ssize_t n;
+      off_t left = st.st_size;
+      while (left > 0 && (n = copy_file_range (in, NULL, out, NULL, left, 0)) > 0)
+        left -= n;
+      struct timespec times[2] = { st.st_atim, st.st_mtim };
+      if (left == 0 && fchmod (out, st.st_mode & 07777) == 0
+          && futimens (out, times) == 0 && close (out) == 0)
+        {
+          close (in);
+          return 0;
+        }
+      close (out);
+    }
+  if (in >= 0)
+    close (in);
+#endif
+  return qcopy_file_preserving (filename, backup);
+}
+
+/*
+ * Save the old file as `backup'.  When the new text goes to a
+ * temporary file renamed over the old one, a hard link keeps the old
+ * file under the backup name for free.
+ */
+static int
+make_backup (const struct save *sv, const char *backup)
+{
+  unlink (backup);
+  if (sv->tmp && link (sv->target, backup) == 0)
+    return 0;
+  return copy_backup (sv->target, backup);
+}
+
 /*
  * Create a backup filename according to user specified variables.
  */
@@ -506,6 +1083,10 @@ create_backup_filename (const char *filename, const char *backupdir)
 static int
 backup_and_write (Buffer bp, const char *filename)
 {
+  struct save sv;
+  save_open (&sv, filename, S_IRUSR | S_IWUSR |
+             S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
   /* Make backup of original file. */
   int fd, backup = get_variable_bool ("make-backup-files");
   if (!get_buffer_backup (bp) && backup
@@ -516,7 +1097,7 @@ backup_and_write (Buffer bp, const char *filename)
       const char *backupdir = get_variable_bool ("backup-directory") ?
         get_variable ("backup-directory") : NULL;
       astr bfilename = create_backup_filename (filename, backupdir);
-      if (bfilename && qcopy_file_preserving (filename, astr_cstr (bfilename)) == 0)
+      if (bfilename && make_backup (&sv, astr_cstr (bfilename)) == 0)
         set_buffer_backup (bp, true);
       else
         {
@@ -525,15 +1106,11 @@ backup_and_write (Buffer bp, const char *filename)
         }
     }
 
-  int ret = write_to_disk (bp, filename, S_IRUSR | S_IWUSR |
-                           S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  int ret = save_commit (&sv, bp);
   if (ret == 0)
     return true;
 
-  if (ret == -1)
-    minibuf_error ("Error writing `%s': %s", filename, strerror (errno));
-  else
-    minibuf_error ("Error writing `%s'", filename);
+  minibuf_error ("Error writing `%s': %s", filename, strerror (errno));
   return false;
 }
 
@@ -597,14 +1174,22 @@ write_buffer (Buffer bp, bool needname, bool confirm,
     {
       if (get_buffer_filename (bp) == NULL ||
           !STREQ (astr_cstr (name), get_buffer_filename (bp)))
-        set_buffer_names (bp, astr_cstr (name));
+        {
+          stop_tail (bp);
+          set_buffer_names (bp, astr_cstr (name));
+        }
       set_buffer_needname (bp, false);
       set_buffer_temporary (bp, false);
       set_buffer_nosave (bp, false);
       if (backup_and_write (bp, astr_cstr (name)))
         {
+          struct stat st;
           minibuf_write ("Wrote %s", astr_cstr (name));
           set_buffer_modified (bp, false);
+          close_buffer_journal (bp, true);
+          set_buffer_journal_held (bp, false);
+          set_buffer_journal_base (bp, journal_header (stat (astr_cstr (name), &st) == 0
+                                                       ? &st : NULL));
           undo_set_unchanged (get_buffer_last_undop (bp));
         }
       else
@@ -747,6 +1332,7 @@ Offer to save each buffer, then kill this Zile process.
         break; /* We have found a modified buffer, so stop. */
       }
 
+  flush_journals ();
   global.thisflag |= FLAG_QUIT;
 }
 END_DEFUN
@@ -764,6 +1350,21 @@ zile_exit (bool doabort)
   for (Buffer bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
     if (get_buffer_modified (bp) && !get_buffer_nosave (bp))
       {
+        /* A journal only needs its last edits written. */
+        if (flush_buffer_journal (bp))
+          {
+            fprintf (stderr, "Saved journal of %s\r\n", get_buffer_filename (bp));
+            continue;
+          }
+
+        /* The text past the end of a cut short mapping is lost. */
+        if (buffer_mapping_cut (bp))
+          {
+            fprintf (stderr, "Cannot save %s: its file was cut short\r\n",
+                     get_buffer_name (bp));
+            continue;
+          }
+
         astr buf = astr_fmt ("%s.%sSAVE",
                              get_buffer_filename_or_name (bp),
                              astr_cstr (astr_recase (astr_new_cstr (PACKAGE), case_upper)));
@@ -23,7 +23,10 @@ astr get_home_dir (void);
 astr agetcwd (void);
 bool expand_path (astr path);
 astr compact_path (astr path);
-bool find_file (const char *filename);
+void preload_visits (gl_list_t filenames);
+bool find_file (const char *filename, bool readonly);
+void stop_tail (Buffer bp);
+bool follow_tails (void);
 void _Noreturn zile_exit (bool doabort);
 
 #endif
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include "gl_array_list.h"
 #include "pipe-filter.h"
 
 #include "main.h"
@@ -136,6 +137,19 @@ automatically breaks the line at a previous space.
 }
 END_DEFUN
 
+DEFUN ("large-file-mode", large_file_mode)
+/*+
+Toggle large-file mode.
+In large-file mode, line numbers beyond the part of the buffer read in
+so far are estimated, `linum-mode' and region highlighting are off,
+and changes bigger than a megabyte cannot be undone.
+Files bigger than `large-file-threshold' are visited in this mode.
++*/
+{
+  set_buffer_large (global.cur_bp, !get_buffer_large (global.cur_bp));
+}
+END_DEFUN
+
 DEFUN ("set-fill-column", set_fill_column)
 /*+
 Set `fill-column' to specified argument.
@@ -827,13 +841,33 @@ Fill paragraph at or after point.
     /* Move to next line if between two paragraphs. */
     next_line ();
 
-  while (buffer_end_of_line (global.cur_bp, get_buffer_pt (global.cur_bp)) < get_marker_o (m_end))
+  /* Join the lines, leaving one space in place of each line break and
+     the spaces around it. */
+  gl_list_t edits = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  const_estr space = estr_new (astr_new_cstr (" "), get_buffer_eol (global.cur_bp));
+  size_t eol_len = get_buffer_eol_len (global.cur_bp);
+  size_t bol = get_buffer_line_o (global.cur_bp);
+  for (size_t eo = buffer_end_of_line (global.cur_bp, bol);
+       eo < get_marker_o (m_end);
+       eo = buffer_end_of_line (global.cur_bp, eo + eol_len))
     {
-      FUNCALL (end_of_line);
-      delete_char ();
-      FUNCALL (just_one_space);
+      size_t n = gl_list_size (edits);
+      Edit prev = n > 0 ? (Edit) gl_list_get_at (edits, n - 1) : NULL;
+      size_t floor = prev ? prev->o + prev->del : bol;
+      size_t from = eo, to = eo + eol_len, next_eo = buffer_end_of_line (global.cur_bp, to);
+      while (from > floor && isspace ((unsigned char) get_buffer_char (global.cur_bp, from - 1)))
+        from--;
+      while (to < next_eo && isspace ((unsigned char) get_buffer_char (global.cur_bp, to)))
+        to++;
+
+      /* A blank line also swallows the space left by the previous join. */
+      if (prev && from == floor)
+        prev->del = to - prev->o;
+      else
+        gl_list_add_last (edits, edit_new (from, to - from, space));
     }
   unchain_marker (m_end);
+  replace_edits (edits);
 
   FUNCALL (end_of_line);
   int ret;
@@ -935,19 +969,28 @@ setcase_region (int (*func) (int))
   if (warn_if_readonly_buffer () || warn_if_no_mark ())
     return leNIL;
 
+  /* Replace each run of characters that change case. */
   Region r = calculate_the_region ();
-  Marker m = point_marker ();
-  goto_offset (get_region_start (r));
-  for (size_t size = get_region_size (r); size > 0; size--)
+  gl_list_t edits = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  astr run = NULL;
+  for (size_t o = get_region_start (r); o <= get_region_end (r); o++)
     {
-      char c = func (following_char ());
-      delete_char ();
-      insert_char (c);
+      int c = o < get_region_end (r) ? (unsigned char) get_buffer_char (global.cur_bp, o) : EOF;
+      if (c != EOF && func (c) != c)
+        {
+          if (run == NULL)
+            run = astr_new ();
+          astr_cat_char (run, func (c));
+        }
+      else if (run != NULL)
+        {
+          gl_list_add_last (edits, edit_new (o - astr_len (run), astr_len (run),
+                                             estr_new (run, get_buffer_eol (global.cur_bp))));
+          run = NULL;
+        }
     }
-  goto_offset (get_marker_o (m));
-  unchain_marker (m);
 
-  return leT;
+  return bool_to_lisp (replace_edits (edits));
 }
 
 DEFUN ("upcase-region", upcase_region)
@@ -1011,7 +1054,8 @@ static le *
 pipe_command (const_astr cmd, astr input, bool do_insert, bool do_replace)
 {
   const char *prog_argv[] = { "/bin/sh", "-c", astr_cstr (cmd), NULL };
-  pipe_data inout = { .in = input, .out = astr_new (), .done = 0 };
+  /* Filters mostly produce about as much text as they are fed. */
+  pipe_data inout = { .in = input, .out = astr_reserve (astr_new (), astr_len (input)), .done = 0 };
   if (pipe_filter_ii_execute (ZILE_PACKAGE_NAME, "/bin/sh", prog_argv, true, false,
                               prepare_write, done_write, prepare_read, done_read,
                               &inout) != 0)
@@ -1187,7 +1231,7 @@ On nonblank line, delete any immediately following blank lines.
   /* If we are deleting to EOB, need to fudge extra line. */
   bool at_eob = get_region_end (r) == get_buffer_size (global.cur_bp) && get_region_start (r) > 0;
   if (at_eob)
-    set_region_start (r, get_region_start (r) - strlen (get_buffer_eol (global.cur_bp)));
+    set_region_start (r, get_region_start (r) - get_buffer_eol_len (global.cur_bp));
 
   /* Delete any blank lines found. */
   if (get_region_start (r) < get_region_end (r))
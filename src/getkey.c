@@ -28,6 +28,8 @@
 
 #include "main.h"
 #include "extern.h"
+#include "buffer.h"
+#include "file.h"
 #include "macro.h"
 #include "term_curses.h"
 
@@ -78,8 +80,30 @@ getkey (int delay)
       timeradd (&now, &refresh_wait, &next_refresh);
     }
 
+  /* Read in huge files while no key is pressed. */
+  if (delay == GETKEY_DEFAULT)
+    while (keycode == KBD_NOKEY && load_buffers ()
+           && (keycode = getkeystroke (0)) == KBD_NOKEY)
+      {
+        term_redisplay ();
+        term_refresh ();
+      }
+
   if (keycode == KBD_NOKEY)
-    keycode = getkeystroke (delay);
+    {
+      flush_journals ();
+
+      /* Follow the files being tailed while no key is pressed. */
+      if (delay == GETKEY_DEFAULT)
+        while (follow_tails () && (keycode = getkeystroke (0)) == KBD_NOKEY)
+          {
+            term_redisplay ();
+            term_refresh ();
+          }
+
+      if (keycode == KBD_NOKEY)
+        keycode = getkeystroke (delay);
+    }
 
   return keycode;
 }
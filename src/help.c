@@ -36,6 +36,7 @@
 #include "buffer.h"
 #include "line.h"
 #include "minibuf.h"
+#include "eolscan.h"
 
 static void
 write_function_description (va_list ap)
@@ -182,3 +183,27 @@ Display documentation of the command invoked by a key sequence.
 
 }
 END_DEFUN
+
+static void
+write_statistics (va_list ap _GL_UNUSED_PARAMETER)
+{
+  size_t bytes, reallocs = astr_reallocs (&bytes);
+
+  bprintf ("Editor statistics:\n\n");
+  bprintf ("%-24s %zu (%zu bytes)\n", "String reallocations", reallocs, bytes);
+  bprintf ("%-24s %s\n", "EOL scanning kernels", eolscan_isa ());
+  size_t copied, mapped = rope_mapped_bytes (&copied);
+  bprintf ("%-24s %zu (%zu bytes copied)\n", "Mapped file bytes", mapped, copied);
+  size_t misses, hits = regex_cache_hits (&misses);
+  bprintf ("%-24s %zu (%zu compiled)\n", "Regex cache hits", hits, misses);
+}
+
+DEFUN ("describe-statistics", describe_statistics)
+/*+
+Display internal counters of the editor, such as the number of times
+string buffers have been reallocated.
++*/
+{
+  write_temp_buffer ("*Help*", true, write_statistics);
+}
+END_DEFUN
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "dirname.h"
+#include "gl_array_list.h"
+
+#include "main.h"
+#include "buffer.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC PACKAGE " journal"
+
+struct Journal
+{
+  char *name;        /* The journal file. */
+  int fd;            /* The journal file, open for writing, or -1. */
+  astr pending;      /* Records not written yet. */
+};
+
+// Return the header of a journal of edits to a file found to be `st',
+// or that did not exist if `st' is NULL.
+astr
+journal_header (const struct stat *st)
+{
+  if (st == NULL)
+    return astr_fmt ("%s 0 0.000000000\n", JOURNAL_MAGIC);
+  return astr_fmt ("%s %jd %jd.%09ld\n", JOURNAL_MAGIC, (intmax_t) st->st_size,
+                   (intmax_t) st->st_mtim.tv_sec, (long) st->st_mtim.tv_nsec);
+}
+
+// Return the header of the journal of `filename' as it is now.
+static astr
+file_header (const char *filename)
+{
+  struct stat st;
+  return journal_header (stat (filename, &st) == 0 ? &st : NULL);
+}
+
+// Return the name of the journal of `filename', `#BASE.journal#' in
+// the file's directory.
+astr
+journal_name (const char *filename)
+{
+  return astr_fmt ("%s/#%s.journal#", dir_name (filename), base_name (filename));
+}
+
+// Start a journal for `filename', replacing any old one, of edits to
+// the file described by `header', or to the file as it is now if NULL.
+Journal
+journal_new (const char *filename, const_astr header)
+{
+  Journal jp = XZALLOC (struct Journal);
+  jp->name = xstrdup (astr_cstr (journal_name (filename)));
+  jp->fd = open (jp->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  jp->pending = astr_cpy (astr_new (), header ? header : file_header (filename));
+  journal_flush (jp);
+  return jp;
+}
+
+// Go on with the journal of `filename', whose first `len' bytes hold
+// whole edits; the rest, an edit cut short, is dropped.
+Journal
+journal_resume (const char *filename, size_t len)
+{
+  Journal jp = XZALLOC (struct Journal);
+  jp->name = xstrdup (astr_cstr (journal_name (filename)));
+  jp->fd = open (jp->name, O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (jp->fd >= 0 && ftruncate (jp->fd, (off_t) len) != 0)
+    {
+      close (jp->fd);
+      jp->fd = -1;
+    }
+  jp->pending = astr_new ();
+  return jp;
+}
+
+// Record that `del' bytes at `o' were replaced by `as'.
+void
+journal_record (Journal jp, size_t o, size_t del, const_astr as)
+{
+  if (jp->fd < 0)
+    return;
+  astr_cat (jp->pending, astr_fmt ("%zu %zu %zu\n", o, del, astr_len (as)));
+  astr_cat (jp->pending, as);
+  if (astr_len (jp->pending) >= JOURNAL_BATCH)
+    journal_flush (jp);
+}
+
+// Write the pending records; return false if they could not be
+// written, in which case the journal is abandoned.
+bool
+journal_flush (Journal jp)
+{
+  const char *s = astr_cstr (jp->pending);
+  size_t len = astr_len (jp->pending);
+  while (len > 0 && jp->fd >= 0)
+    {
+      ssize_t n = write (jp->fd, s, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          close (jp->fd);
+          jp->fd = -1;
+          break;
+        }
+      s += n;
+      len -= n;
+    }
+  astr_truncate (jp->pending, 0);
+  return jp->fd >= 0;
+}
+
+// Close the journal, removing its file if `remove'.
+void
+journal_close (Journal jp, bool remove)
+{
+  if (jp->fd >= 0)
+    close (jp->fd);
+  jp->fd = -1;
+  astr_truncate (jp->pending, 0);
+  if (remove)
+    unlink (jp->name);
+}
+
+// Parse a decimal number at `*p', before `end', followed by `sep'.
+static bool
+parse_size (const char **p, const char *end, char sep, size_t *n)
+{
+  const char *s = *p;
+  for (*n = 0; s < end && *s >= '0' && *s <= '9'; s++)
+    *n = *n * 10 + (*s - '0');
+  if (s == *p || s == end || *s != sep)
+    return false;
+  *p = s + 1;
+  return true;
+}
+
+/*
+ * Read the journal of `filename', whose inserted text has EOLs `eol'.
+ * Return the list of its edits, each applying to the text left by the
+ * previous ones; an edit cut short when the journal was written is
+ * dropped, and the length of the journal up to it is stored in `len'.
+ * Return NULL with errno set to ENOENT if there is no journal, or to
+ * EINVAL if it does not apply to the file as it is now.
+ */
+gl_list_t
+journal_read (const char *filename, const char *eol, size_t *len)
+{
+  astr as = astr_readf (astr_cstr (journal_name (filename)));
+  if (as == NULL)
+    return NULL;
+
+  const_astr header = file_header (filename);
+  if (astr_len (as) < astr_len (header)
+      || memcmp (astr_cstr (as), astr_cstr (header), astr_len (header)) != 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  gl_list_t edits = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  const char *p = astr_cstr (as) + astr_len (header), *end = astr_cstr (as) + astr_len (as);
+  size_t o, del, n;
+  for (*len = p - astr_cstr (as);
+       parse_size (&p, end, ' ', &o) && parse_size (&p, end, ' ', &del)
+         && parse_size (&p, end, '\n', &n) && n <= (size_t) (end - p);
+       *len = p - astr_cstr (as))
+    {
+      const_astr text = const_astr_new_nstr (p, n);
+      gl_list_add_last (edits, edit_new (o, del, estr_new (text, eol)));
+      p += n;
+    }
+  return edits;
+}
@@ -0,0 +1,55 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+
+#include "main.h"
+
+/*
+ * A journal records the edits made to a buffer since its file was
+ * last saved, so that they can be replayed onto the file after a
+ * crash.  The journal file starts with a header line giving the size
+ * and modification time of the file the edits apply to, as it was when
+ * the buffer last read or wrote it, followed by a
+ * line "OFFSET DELETED LENGTH" and the LENGTH inserted bytes for each
+ * edit.  Edits are kept in memory and appended to the file in batches
+ * of JOURNAL_BATCH bytes, and whenever the editor waits for keys, so
+ * the cost of journaling depends only on the size of the edits.
+ *
+ * A journal found when its file is visited is kept as it is, and the
+ * edits to the buffer go unrecorded, until it is recovered, the file
+ * is saved, or the journal is removed.  Recovering goes on with it,
+ * appending the edits made after those replayed.
+ */
+
+#define JOURNAL_BATCH (64 * 1024)
+
+typedef struct Journal *Journal;
+
+astr journal_name (const char *filename);
+astr journal_header (const struct stat *st);
+Journal journal_new (const char *filename, const_astr header);
+Journal journal_resume (const char *filename, size_t len);
+void journal_record (Journal jp, size_t o, size_t del, const_astr as);
+bool journal_flush (Journal jp);
+void journal_close (Journal jp, bool remove);
+gl_list_t journal_read (const char *filename, const char *eol, size_t *len);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include "xalloc.h"
+#include "size_max.h"
+
+#include "main.h"
+#include "buffer.h"
+#include "lineindex.h"
+#include "eolscan.h"
+
+struct LineIndex
+{
+  size_t blocks;     /* Number of blocks. */
+  size_t maxblocks;  /* Allocated blocks. */
+  size_t *size;      /* Size of each block. */
+  size_t *eols;      /* Number of EOLs starting in each block. */
+  size_t *fsize;     /* Fenwick tree of `size', indexed from 1. */
+  size_t *feols;     /* Fenwick tree of `eols', indexed from 1. */
+  size_t covered;    /* Size of the indexed prefix of the text. */
+};
+
+// ================ Fenwick trees ==========================
+
+static void
+fenwick_build (size_t *tree, const size_t *v, size_t n)
+{
+  memcpy (tree + 1, v, n * sizeof (size_t));
+  for (size_t i = 1; i <= n; i++)
+    {
+      size_t j = i + (i & -i);
+      if (j <= n)
+        tree[j] += tree[i];
+    }
+}
+
+// Add `delta' (modulo SIZE_MAX + 1) to the element `i'.
+static void
+fenwick_add (size_t *tree, size_t n, size_t i, size_t delta)
+{
+  for (i++; i <= n; i += i & -i)
+    tree[i] += delta;
+}
+
+// Sum of the first `i' elements.
+static size_t
+fenwick_prefix (const size_t *tree, size_t i)
+{
+  size_t sum = 0;
+  for (; i > 0; i -= i & -i)
+    sum += tree[i];
+  return sum;
+}
+
+// Append the element `v' to a tree of `n' elements.
+static void
+fenwick_append (size_t *tree, size_t n, size_t v)
+{
+  size_t i = n + 1;
+  tree[i] = v + fenwick_prefix (tree, i - 1) - fenwick_prefix (tree, i - (i & -i));
+}
+
+/*
+ * Return the number of leading elements whose sum is not greater than
+ * `*rem' (resp. smaller than it if `strict'), subtracting their sum
+ * from `*rem'.
+ */
+static size_t
+fenwick_find (const size_t *tree, size_t n, size_t *rem, bool strict)
+{
+  size_t pos = 0, step = 1;
+  while (step * 2 <= n)
+    step *= 2;
+  for (; step > 0; step /= 2)
+    if (pos + step <= n
+        && (strict ? tree[pos + step] < *rem : tree[pos + step] <= *rem))
+      {
+        pos += step;
+        *rem -= tree[pos];
+      }
+  return pos;
+}
+
+// ================ Text scanning ==========================
+
+/*
+ * Count the EOLs starting in [a, b), or return the offset of the
+ * `nth' one if `nth' is not zero.
+ */
+static size_t
+scan_eols (Buffer bp, size_t a, size_t b, size_t nth)
+{
+  const char *eol = get_buffer_eol (bp);
+  size_t eol_len = get_buffer_eol_len (bp), size = get_buffer_size (bp), n = 0;
+  for (size_t o = a, len; o < b; o += len)
+    {
+      const char *s = get_buffer_segment (bp, o, &len);
+      size_t end = MIN (len, b - o);
+      if (nth == 0)
+        {
+          /* Count with the vector kernels, then look for a CRLF
+             straddling the end of the run. */
+          n += eolscan_count (s, end, eol);
+          if (eol_len == 2 && s[end - 1] == eol[0] && o + end < size
+              && (end < len ? s[end] : get_buffer_char (bp, o + end)) == eol[1])
+            n++;
+          continue;
+        }
+      for (const char *p = s; (p = memchr (p, eol[0], end - (p - s))) != NULL; p++)
+        {
+          size_t po = o + (p - s);
+          if (eol_len == 2
+              && (po + 1 >= size
+                  || (p + 1 < s + len ? p[1] : get_buffer_char (bp, po + 1)) != eol[1]))
+            continue;
+          if (++n == nth)
+            return po;
+        }
+    }
+  return n;
+}
+
+// Return the block holding offset `o', storing its start in `start'.
+static size_t
+block_at (LineIndex li, size_t o, size_t *start)
+{
+  size_t rem = o;
+  size_t b = fenwick_find (li->fsize, li->blocks, &rem, false);
+  if (b == li->blocks)
+    {
+      b--;
+      rem = li->size[b];
+    }
+  *start = o - rem;
+  return b;
+}
+
+static void
+reserve_blocks (LineIndex li, size_t blocks)
+{
+  if (blocks > li->maxblocks)
+    {
+      li->maxblocks = MAX (blocks, li->maxblocks * 2);
+      li->size = xnrealloc (li->size, li->maxblocks, sizeof (size_t));
+      li->eols = xnrealloc (li->eols, li->maxblocks, sizeof (size_t));
+      li->fsize = xnrealloc (li->fsize, li->maxblocks + 1, sizeof (size_t));
+      li->feols = xnrealloc (li->feols, li->maxblocks + 1, sizeof (size_t));
+    }
+}
+
+// Replace the blocks [first, last] by `n' uninitialised blocks.
+static void
+splice_blocks (LineIndex li, size_t first, size_t last, size_t n)
+{
+  size_t tail = li->blocks - (last + 1), blocks = first + n + tail;
+  reserve_blocks (li, blocks);
+  memmove (li->size + first + n, li->size + last + 1, tail * sizeof (size_t));
+  memmove (li->eols + first + n, li->eols + last + 1, tail * sizeof (size_t));
+  li->blocks = blocks;
+}
+
+/*
+ * Fill the blocks from `first' on with `n' blocks covering `size'
+ * bytes of text from `o', counting their EOLs; if `update', the
+ * Fenwick trees are updated too.
+ */
+static void
+fill_blocks (LineIndex li, Buffer bp, size_t first, size_t n, size_t o, size_t size, bool update)
+{
+  for (size_t i = 0, b = first; i < n; i++, b++)
+    {
+      size_t from = size * i / n, to = size * (i + 1) / n;
+      size_t eols = scan_eols (bp, o + from, o + to, 0);
+      if (update)
+        {
+          fenwick_add (li->fsize, li->blocks, b, (to - from) - li->size[b]);
+          fenwick_add (li->feols, li->blocks, b, eols - li->eols[b]);
+        }
+      li->size[b] = to - from;
+      li->eols[b] = eols;
+    }
+}
+
+/*
+ * Index the text up to offset `o', and at least LINEINDEX_STEP more
+ * bytes, so that reaching a bit further does not scan again.
+ */
+static void
+extend (LineIndex li, Buffer bp, size_t o)
+{
+  size_t size = get_buffer_size (bp);
+  if (li->blocks > 0 && (li->covered >= o || li->covered == size))
+    return;
+
+  size_t end = MIN (size, MAX (o, li->covered + LINEINDEX_STEP));
+  size_t n = MAX ((end - li->covered + LINEINDEX_BLOCK - 1) / LINEINDEX_BLOCK, 1);
+  reserve_blocks (li, li->blocks + n);
+  fill_blocks (li, bp, li->blocks, n, li->covered, end - li->covered, false);
+  for (size_t i = 0; i < n; i++, li->blocks++)
+    {
+      fenwick_append (li->fsize, li->blocks, li->size[li->blocks]);
+      fenwick_append (li->feols, li->blocks, li->eols[li->blocks]);
+    }
+  li->covered = end;
+}
+
+// ================ Public ================================
+
+LineIndex
+lineindex_new (void)
+{
+  return XZALLOC (struct LineIndex);
+}
+
+/*
+ * Merge neighbouring blocks whose text fits in two usual blocks, when
+ * deletions have left too many small ones.  No text is scanned.
+ */
+static void
+merge_blocks (LineIndex li)
+{
+  size_t n = 0;
+  for (size_t b = 0; b < li->blocks; b++)
+    if (n > 0 && li->size[n - 1] + li->size[b] <= 2 * LINEINDEX_BLOCK)
+      {
+        li->size[n - 1] += li->size[b];
+        li->eols[n - 1] += li->eols[b];
+      }
+    else
+      {
+        li->size[n] = li->size[b];
+        li->eols[n] = li->eols[b];
+        n++;
+      }
+  li->blocks = n;
+  fenwick_build (li->fsize, li->size, li->blocks);
+  fenwick_build (li->feols, li->eols, li->blocks);
+}
+
+/*
+ * Update the index after `del' bytes at `o' have been replaced by
+ * `len' bytes.  Only the blocks overlapping the edit, widened by an
+ * EOL that the edit may have joined or split, are recounted, and the
+ * text left in them is shared out among the same blocks, so that the
+ * trees only need O(log n) updates per block.  Blocks are split when
+ * they would grow past LINEINDEX_MAX, and merged when most of them
+ * have been emptied; both rebuild the trees, but only after the edits
+ * have added or removed text in proportion.  An edit past the indexed
+ * prefix is left for the next extension, and one straddling its end
+ * cuts the prefix back.
+ */
+void
+lineindex_update (LineIndex li, Buffer bp, size_t o, size_t del, size_t len)
+{
+  if (li->blocks == 0 || o > li->covered)
+    return;
+
+  size_t eol_len = get_buffer_eol_len (bp);
+  size_t start, last_start;
+  size_t first = block_at (li, o - MIN (o, eol_len - 1), &start);
+  if (o + del > li->covered)
+    {
+      li->blocks = first;
+      li->covered = start;
+      return;
+    }
+  size_t last = block_at (li, del > 0 ? o + del - 1 : o, &last_start);
+
+  size_t oldsize = last_start + li->size[last] - start;
+  size_t size = oldsize - del + len;
+  li->covered = li->covered - del + len;
+
+  size_t n = last + 1 - first;
+  if (size > n * LINEINDEX_MAX)
+    {
+      n = size / LINEINDEX_BLOCK;
+      splice_blocks (li, first, last, n);
+      fill_blocks (li, bp, first, n, start, size, false);
+      fenwick_build (li->fsize, li->size, li->blocks);
+      fenwick_build (li->feols, li->eols, li->blocks);
+    }
+  else
+    {
+      fill_blocks (li, bp, first, n, start, size, true);
+      if (li->blocks > 2 * (li->covered / LINEINDEX_BLOCK + 1))
+        merge_blocks (li);
+    }
+}
+
+// Return the number of EOLs starting before `o'.
+size_t
+lineindex_line (LineIndex li, Buffer bp, size_t o)
+{
+  extend (li, bp, o);
+  size_t start;
+  size_t b = block_at (li, o, &start);
+  return fenwick_prefix (li->feols, b) + scan_eols (bp, start, o, 0);
+}
+
+// Return the offset of the start of line `n', or SIZE_MAX.
+size_t
+lineindex_offset (LineIndex li, Buffer bp, size_t n)
+{
+  if (n == 0)
+    return 0;
+  extend (li, bp, 0);
+  while (n > fenwick_prefix (li->feols, li->blocks))
+    {
+      if (li->covered == get_buffer_size (bp))
+        return SIZE_MAX;
+      extend (li, bp, li->covered + 1);
+    }
+
+  size_t rem = n;
+  size_t b = fenwick_find (li->feols, li->blocks, &rem, true);
+  size_t start = fenwick_prefix (li->fsize, b);
+  return scan_eols (bp, start, start + li->size[b], rem) + get_buffer_eol_len (bp);
+}
+
+// Return the size of the indexed prefix of the text.
+size_t
+lineindex_covered (LineIndex li)
+{
+  return li->covered;
+}
+
+// Index one more step of the text.
+void
+lineindex_advance (LineIndex li, Buffer bp)
+{
+  extend (li, bp, li->covered + 1);
+}
@@ -0,0 +1,49 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+
+/*
+ * The line index splits the buffer text in blocks of about
+ * LINEINDEX_BLOCK bytes and keeps the size and the number of EOLs
+ * starting in each block in two Fenwick trees, so that converting
+ * between offsets and line numbers costs O(log n) plus the scan of a
+ * single block.  Edits only recount the blocks they touch, whose sizes
+ * then drift between zero and LINEINDEX_MAX.
+ *
+ * Only a prefix of the text is indexed, which is extended as offsets
+ * beyond it are asked for, and in the background while the editor
+ * waits for keys, so that a huge file is never scanned at once.
+ */
+
+#define LINEINDEX_BLOCK 8192  /* Size of the blocks of a new index. */
+#define LINEINDEX_MAX   (4 * LINEINDEX_BLOCK) /* Size at which a block is split. */
+#define LINEINDEX_STEP  (4 * 1024 * 1024) /* Minimum extension of the prefix. */
+
+typedef struct LineIndex *LineIndex;
+
+LineIndex lineindex_new (void);
+void lineindex_update (LineIndex li, Buffer bp, size_t o, size_t del, size_t len);
+size_t lineindex_line (LineIndex li, Buffer bp, size_t o);
+size_t lineindex_offset (LineIndex li, Buffer bp, size_t n);
+_GL_ATTRIBUTE_PURE size_t lineindex_covered (LineIndex li);
+void lineindex_advance (LineIndex li, Buffer bp);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+#include "main.h"
+#include "literal.h"
+#include "eolscan.h"
+
+/* Patterns shorter than this searched forward without case are found
+   by their first byte rather than by skipping. */
+#define LITERAL_FILTER_MAX 8
+
+struct Literal
+{
+  unsigned char *pat;                  /* The pattern, folded. */
+  size_t len;
+  bool icase;
+  unsigned char fold[UCHAR_MAX + 1];   /* The folding of each byte. */
+  size_t skip[UCHAR_MAX + 1];          /* Forward shift by the window's last byte. */
+  size_t rskip[UCHAR_MAX + 1];         /* Backward shift by the window's first byte. */
+};
+
+Literal
+literal_new (const char *s, size_t len, bool icase)
+{
+  Literal lp = XZALLOC (struct Literal);
+  lp->len = len;
+  lp->icase = icase;
+  for (size_t c = 0; c <= UCHAR_MAX; c++)
+    {
+      lp->fold[c] = icase ? tolower ((int) c) : c;
+      lp->skip[c] = lp->rskip[c] = len;
+    }
+
+  lp->pat = (unsigned char *) xmalloc (len + 1);
+  for (size_t i = 0; i < len; i++)
+    lp->pat[i] = lp->fold[(unsigned char) s[i]];
+  for (size_t i = 0; i + 1 < len; i++)
+    lp->skip[lp->pat[i]] = len - 1 - i;
+  for (size_t i = len; i > 1; i--)
+    lp->rskip[lp->pat[i - 1]] = i - 1;
+
+  return lp;
+}
+
+// Return true if `lp' matches at `s'.
+static bool
+match (Literal lp, const unsigned char *s)
+{
+  for (size_t i = 0; i < lp->len; i++)
+    if (lp->fold[s[i]] != lp->pat[i])
+      return false;
+  return true;
+}
+
+const char *
+literal_find (Literal lp, const char *s, size_t len)
+{
+  if (lp->len > len)
+    return NULL;
+  if (lp->len == 0)
+    return s;
+  if (!lp->icase)
+    return memmem (s, len, lp->pat, lp->len);
+
+  const unsigned char *t = (const unsigned char *) s;
+  if (lp->len < LITERAL_FILTER_MAX)
+    {
+      char a = lp->pat[0], b = toupper (lp->pat[0]);
+      for (const char *p = s; (p = eolscan_find_either (p, len - lp->len + 1 - (p - s), a, b)) != NULL; p++)
+        if (match (lp, (const unsigned char *) p))
+          return p;
+      return NULL;
+    }
+
+  for (size_t i = 0; i + lp->len <= len; i += lp->skip[lp->fold[t[i + lp->len - 1]]])
+    if (match (lp, t + i))
+      return s + i;
+  return NULL;
+}
+
+const char *
+literal_rfind (Literal lp, const char *s, size_t len)
+{
+  if (lp->len > len)
+    return NULL;
+  if (lp->len == 0)
+    return s + len;
+
+  const unsigned char *t = (const unsigned char *) s;
+  for (size_t i = len - lp->len;; i -= lp->rskip[lp->fold[t[i]]])
+    {
+      if (match (lp, t + i))
+        return s + i;
+      if (i < lp->rskip[lp->fold[t[i]]])
+        return NULL;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef LITERAL_H
+#define LITERAL_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Matchers for literal strings, used for the searches that are not
+ * regexp searches.  Case-sensitive forward searches use memmem, which
+ * is the Two-Way algorithm; the others use Boyer-Moore-Horspool on
+ * bytes folded to lower case when `icase'.  Short patterns searched
+ * forward without case are found instead by looking for either case
+ * of their first byte with the vector kernels of eolscan.
+ */
+
+typedef struct Literal *Literal;
+
+Literal literal_new (const char *s, size_t len, bool icase);
+
+// Return the first match of `lp' in `s', or NULL.
+_GL_ATTRIBUTE_PURE const char *literal_find (Literal lp, const char *s, size_t len);
+
+// Return the last match of `lp' in `s', or NULL.
+_GL_ATTRIBUTE_PURE const char *literal_rfind (Literal lp, const char *s, size_t len);
+
+#endif
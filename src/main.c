@@ -285,6 +285,13 @@ main (int argc, char **argv)
       FUNCALL (beginning_of_buffer);
     }
 
+  /* Start reading the files given on the command line. */
+  gl_list_t files = gl_list_create_empty (GL_LINKED_LIST, NULL, NULL, NULL, true);
+  for (size_t i = 0; i < gl_list_size (arg_arg); i++)
+    if ((ptrdiff_t) gl_list_get_at (arg_type, i) == arg_file)
+      gl_list_add_last (files, gl_list_get_at (arg_arg, i));
+  preload_visits (files);
+
   /* Load files and load files and run functions given on the command
      line. */
   bool ok = true;
@@ -309,7 +316,7 @@ main (int argc, char **argv)
           break;
         case arg_file:
           {
-            ok = find_file (arg);
+            ok = find_file (arg, false);
             if (ok)
               FUNCALL_ARG (goto_line, (size_t) gl_list_get_at (arg_line, i));
           }
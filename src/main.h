@@ -58,6 +58,8 @@ typedef struct Binding *Binding;
 typedef struct Buffer *Buffer;
 typedef struct Window *Window;
 typedef struct Completion *Completion;
+typedef struct Tail *Tail;
+typedef struct Occur *Occur;
 
 
 /* Opaque types. */
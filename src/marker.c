@@ -41,53 +41,215 @@ MARKER_FIELDS
 
 
 
-Marker
-marker_new (void)
+/*
+ * Treap of markers
+ */
+
+static unsigned
+marker_random (void)
 {
-  return (Marker) XZALLOC (struct Marker);
+  /* xorshift32: priorities only need to be well spread. */
+  static unsigned seed = 2463534242u;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Pass a pending collapse of `t' on to its children.
+static void
+marker_push (Marker t)
+{
+  if (t->flat)
+    {
+      if (t->left)
+        {
+          t->left->rel = 0;
+          t->left->flat = true;
+        }
+      if (t->right)
+        {
+          t->right->rel = 0;
+          t->right->flat = true;
+        }
+      t->flat = false;
+    }
+}
+
+// Push the pending operations down from the root to `t'.
+static void
+marker_push_path (Marker t)
+{
+  if (t->parent)
+    marker_push_path (t->parent);
+  marker_push (t);
+}
+
+static void
+set_left (Marker t, Marker child)
+{
+  t->left = child;
+  if (child)
+    child->parent = t;
+}
+
+static void
+set_right (Marker t, Marker child)
+{
+  t->right = child;
+  if (child)
+    child->parent = t;
+}
+
+/* Join `a' and `b', whose offsets are relative to the same base and
+   whose markers all come before those of `b'. */
+static Marker
+marker_merge (Marker a, Marker b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->prio > b->prio)
+    {
+      marker_push (a);
+      b->rel -= a->rel;
+      set_right (a, marker_merge (a->right, b));
+      return a;
+    }
+  marker_push (b);
+  a->rel -= b->rel;
+  set_left (b, marker_merge (a, b->left));
+  return b;
+}
+
+/* Split `t', whose offsets are relative to `base', into the markers
+   at offsets not greater than `o' and the rest. */
+static void
+marker_split (Marker t, size_t base, size_t o, Marker *l, Marker *r)
+{
+  if (t == NULL)
+    {
+      *l = *r = NULL;
+      return;
+    }
+
+  marker_push (t);
+  size_t to = base + t->rel;
+  Marker part;
+  if (to <= o)
+    {
+      marker_split (t->right, to, o, &part, r);
+      set_right (t, part);
+      if (*r)
+        (*r)->rel += t->rel;
+      *l = t;
+    }
+  else
+    {
+      marker_split (t->left, to, o, l, &part);
+      set_left (t, part);
+      if (*l)
+        (*l)->rel += t->rel;
+      *r = t;
+    }
+}
+
+static void
+set_markers_root (Buffer bp, Marker root)
+{
+  if (root)
+    root->parent = NULL;
+  set_buffer_markers (bp, root);
+}
+
+size_t
+get_marker_o (const Marker marker)
+{
+  size_t o = marker->rel;
+  for (Marker t = marker->parent; t != NULL; t = t->parent)
+    {
+      if (t->flat)
+        o = 0;
+      o += t->rel;
+    }
+  return o;
 }
 
 void
-unchain_marker (const Marker marker)
+set_marker_o (Marker marker, size_t o)
 {
-  if (!marker->bp)
-    return;
+  move_marker (marker, marker->bp, o);
+}
 
-  Marker prev = NULL;
-  for (Marker m = get_buffer_markers (marker->bp); m; m = m->next)
+/*
+ * Adjust the markers of `bp' after `del' characters at `o' have been
+ * replaced by `len' characters: the markers inside the deleted text
+ * collapse to `o' and the following ones are shifted.
+ */
+void
+adjust_markers (Buffer bp, size_t o, size_t del, size_t len)
+{
+  Marker before, after, deleted = NULL;
+  marker_split (get_buffer_markers (bp), 0, o, &before, &after);
+  if (after && del > len)
     {
-      if (m == marker)
+      Marker rest;
+      marker_split (after, 0, o + del - len, &deleted, &rest);
+      after = rest;
+      if (deleted)
         {
-          if (prev)
-            prev->next = m->next;
-          else
-            set_buffer_markers (m->bp, m->next);
-
-          m->bp = NULL;
-          break;
+          deleted->rel = o;
+          deleted->flat = true;
         }
-      prev = m;
     }
+  if (after)
+    after->rel += len - del;
+  set_markers_root (bp, marker_merge (marker_merge (before, deleted), after));
+}
+
+Marker
+marker_new (void)
+{
+  Marker marker = (Marker) XZALLOC (struct Marker);
+  marker->prio = marker_random ();
+  return marker;
 }
 
 void
-move_marker (Marker marker, Buffer bp, size_t o)
+unchain_marker (const Marker marker)
 {
-  if (bp != marker->bp)
-    {
-      /* Unchain with the previous pointed buffer.  */
-      unchain_marker (marker);
+  if (!marker->bp)
+    return;
 
-      /* Change the buffer.  */
-      marker->bp = bp;
+  marker_push_path (marker);
+  Marker t = marker_merge (marker->left, marker->right), parent = marker->parent;
+  if (t)
+    t->rel += marker->rel;
+  if (parent == NULL)
+    set_markers_root (marker->bp, t);
+  else if (parent->left == marker)
+    set_left (parent, t);
+  else
+    set_right (parent, t);
 
-      /* Chain with the new buffer.  */
-      marker->next = get_buffer_markers (bp);
-      set_buffer_markers (bp, marker);
-    }
+  marker->left = marker->right = marker->parent = NULL;
+  marker->bp = NULL;
+}
 
-  /* Change the point.  */
-  marker->o = o;
+void
+move_marker (Marker marker, Buffer bp, size_t o)
+{
+  /* Unchain from the tree of the previous buffer.  */
+  unchain_marker (marker);
+
+  /* Chain in the tree of the new buffer at the new point.  */
+  Marker l, r;
+  marker->bp = bp;
+  marker->rel = o;
+  marker->flat = false;
+  marker_split (get_buffer_markers (bp), 0, o, &l, &r);
+  set_markers_root (bp, marker_merge (marker_merge (l, marker), r));
 }
 
 Marker
@@ -97,7 +259,7 @@ copy_marker (const Marker m)
   if (m)
     {
       marker = marker_new ();
-      move_marker (marker, m->bp, m->o);
+      move_marker (marker, m->bp, get_marker_o (m));
     }
   return marker;
 }
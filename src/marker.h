@@ -23,16 +23,25 @@
    MA 02111-1301, USA.  */
 
 #define MARKER_FIELDS							\
-  FIELD(Marker, next)		/* Used to chain all markers in the buffer. */ \
-  FIELD(size_t, o)		/* Marker offset within buffer. */	\
   FIELD(Buffer, bp)		/* Buffer that marker points into. */	\
 
 
+/*
+ * The markers of a buffer are kept in a treap ordered by offset.
+ * Every marker stores its offset relative to its parent, so that an
+ * edit shifts all the markers after it by adjusting the root of a
+ * subtree, and a subtree may be flagged as collapsed into its root
+ * when the text around it is deleted; both are pushed down lazily.
+ */
 typedef struct Marker
 {
 #define FIELD(ty, name) ty name;
   MARKER_FIELDS
 #undef FIELD
+  struct Marker *left, *right, *parent;
+  unsigned prio;	/* Heap priority of the treap. */
+  size_t rel;		/* Offset relative to the parent. */
+  bool flat;		/* All the descendants are at this offset. */
 } *Marker;
 
 #define FIELD(ty, field)                         \
@@ -42,11 +51,15 @@ typedef struct Marker
 MARKER_FIELDS
 #undef FIELD
 
+_GL_ATTRIBUTE_PURE size_t get_marker_o (const Marker marker);
+void set_marker_o (Marker marker, size_t o);
+
 Marker marker_new (void);
 void unchain_marker (const Marker marker);
 void move_marker (Marker marker, Buffer bp, size_t o);
 Marker copy_marker (const Marker marker);
 Marker point_marker (void);
+void adjust_markers (Buffer bp, size_t o, size_t del, size_t len);
 void push_mark (void);
 void pop_mark (void);
 void set_mark (void);
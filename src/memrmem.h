@@ -1,22 +0,0 @@
-/* memrmem
-
-   Copyright (c) 2011-2012 Free Software Foundation, Inc.
-
-   This file is part of GNU Zile.
-
-   GNU Zile is free software; you can redistribute it and/or modify it
-   under the terms of the GNU General Public License as published by
-   the Free Software Foundation; either version 3, or (at your option)
-   any later version.
-
-   GNU Zile is distributed in the hope that it will be useful, but
-   WITHOUT ANY WARRANTY; without even the implied warranty of
-   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
-   General Public License for more details.
-
-   You should have received a copy of the GNU General Public License
-   along with GNU Zile; see the file COPYING.  If not, write to the
-   Free Software Foundation, Fifth Floor, 51 Franklin Street, Boston,
-   MA 02111-1301, USA.  */
-
-_GL_ATTRIBUTE_PURE const char *memrmem (const char *s, size_t slen, const char *t, size_t tlen);
@@ -0,0 +1,808 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "gl_array_list.h"
+
+#include "main.h"
+#include "extern.h"
+
+#include "buffer.h"
+#include "marker.h"
+#include "window.h"
+#include "bind.h"
+#include "eval.h"
+#include "file.h"
+#include "getkey.h"
+#include "term_curses.h"
+#include "minibuf.h"
+#include "variables.h"
+#include "automaton.h"
+#include "eolscan.h"
+#include "occur.h"
+
+/* The time between redisplays while matches are listed. */
+#define OCCUR_REFRESH_MS 100
+
+/* The most text the regex library is given at once. */
+#define OCCUR_WINDOW ((size_t) 1 << 30)
+
+/* The text a thread searches between looks for C-g. */
+#define OCCUR_CHUNK ((size_t) 1 << 22)
+
+/* A match found by a thread, or the end of a source if `line' is 0. */
+struct hit
+{
+  size_t source;
+  size_t line;                    /* The number of its line, or 0. */
+  size_t o;                       /* Its offset, or the number of matches at the end. */
+  size_t len;
+  char text[OCCUR_LINE_MAX];      /* The start of its line. */
+};
+
+struct source
+{
+  Buffer bp;                      /* The buffer searched, */
+  const char *filename;           /* or the file. */
+  const char *s;                  /* The text, if it is contiguous. */
+  size_t size;
+  size_t thread;                  /* The thread searching it, or SIZE_MAX. */
+};
+
+struct worker
+{
+  struct scan *sp;
+  size_t index;
+  struct re_pattern_buffer pattern; /* The regexp, if it has no automaton. */
+  struct hit *hits;               /* A ring of OCCUR_SLOTS hits, */
+  size_t head, tail;              /* written at `head' and read at `tail'. */
+};
+
+struct scan
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;            /* Broadcast on any change to the scan. */
+  struct source *sources;
+  size_t nsources;
+  size_t next;                    /* The first source not taken. */
+  Automaton ap;                   /* The automaton of the regexp, or NULL. */
+  const char *prefix;             /* The text every match starts with, */
+  size_t prefix_len;              /* of this many bytes. */
+  bool icase;
+  struct worker *workers;
+  size_t nworkers;
+  bool stop;                      /* The scan is cut short. */
+};
+
+/* A line of the *Occur* buffer that lists a match. */
+struct match
+{
+  Marker marker;                  /* The match, or NULL if */
+  const char *filename;           /* its file is not visited yet, */
+  size_t o;                       /* at this offset. */
+};
+
+struct Occur
+{
+  gl_list_t matches;              /* The match of each line, or NULL. */
+};
+
+// Return the longest run of the text of `src' that starts at `o',
+// storing its length in `len'.
+static const char *
+segment (const struct source *src, size_t o, size_t *len)
+{
+  if (src->s == NULL)
+    return get_buffer_segment (src->bp, o, len);
+  *len = src->size - o;
+  return src->s + o;
+}
+
+// Return the longest run of the text of `src' that ends at `o', as
+// segment.
+static const char *
+segment_before (const struct source *src, size_t o, size_t *len)
+{
+  if (src->s == NULL)
+    return get_buffer_segment_before (src->bp, o, len);
+  *len = o;
+  return src->s;
+}
+
+// Return the start of the line of `src' that holds `o', or `from' if
+// it starts before it.
+static size_t
+line_start (const struct source *src, size_t from, size_t o)
+{
+  for (size_t len; o > from; o -= len)
+    {
+      const char *s = segment_before (src, o, &len);
+      s += len - MIN (len, o - from);
+      len = MIN (len, o - from);
+      const char *p = eolscan_rfind (s, len, "\n");
+      if (p != NULL)
+        return o - len + (p - s) + 1;
+    }
+  return from;
+}
+
+// Return the offset of the end of the line of `src' that holds `o'.
+static size_t
+line_end (const struct source *src, size_t o)
+{
+  for (size_t len; o < src->size; o += len)
+    {
+      const char *s = segment (src, o, &len);
+      const char *p = eolscan_find (s, len, "\n");
+      if (p != NULL)
+        return o + (p - s);
+    }
+  return src->size;
+}
+
+// Return the number of lines of `src' that end between `from' and `to'.
+static size_t
+count_lines (const struct source *src, size_t from, size_t to)
+{
+  size_t n = 0;
+  for (size_t len; from < to; from += len)
+    {
+      const char *s = segment (src, from, &len);
+      len = MIN (len, to - from);
+      n += eolscan_count (s, len, "\n");
+    }
+  return n;
+}
+
+// Return whether the scan of `sp' is cut short.
+static bool
+stopped (struct scan *sp)
+{
+  pthread_mutex_lock (&sp->lock);
+  bool stop = sp->stop;
+  pthread_mutex_unlock (&sp->lock);
+  return stop;
+}
+
+/*
+ * Find the first match of the regexp of `wp' in `src' at or after `o',
+ * giving up at `last' if none starts before it.  The text is searched in
+ * chunks of whole lines, or in windows for the regex library, and the
+ * search gives up between them once the scan is cut short.
+ */
+static bool
+find_in_run (struct worker *wp, struct source *src, size_t o, size_t last, size_t *start,
+             size_t *end)
+{
+  Automaton ap = wp->sp->ap;
+  if (ap != NULL)
+    {
+      /* A match that may hold a newline may cross any chunk. */
+      if (automaton_newline (ap))
+        return automaton_find (ap, wp->index, src->s == NULL ? src->bp : NULL, src->s,
+                               src->size, o, last, src->size, start, end);
+      for (size_t limit; o < MIN (last, src->size) && !stopped (wp->sp); o = limit)
+        {
+          limit = src->size - o > OCCUR_CHUNK
+            ? MIN (line_end (src, o + OCCUR_CHUNK) + 1, src->size) : src->size;
+          if (automaton_find (ap, wp->index, src->s == NULL ? src->bp : NULL, src->s,
+                              src->size, o, last, limit, start, end))
+            return true;
+        }
+      return false;
+    }
+
+  /* Give the regex library no more than it can index, with a byte of
+     context before `o', and go on from the last line if it fails. */
+  for (;;)
+    {
+      size_t from = o - MIN (o, 1), to = MIN (src->size, from + OCCUR_WINDOW);
+      regoff_t match_start, match_end;
+      struct re_registers regs = { .num_regs = 1, .start = &match_start, .end = &match_end };
+      wp->pattern.not_bol = from > 0;
+      wp->pattern.not_eol = to < src->size;
+      if (re_search_2 (&wp->pattern, NULL, 0, src->s + from, (int) (to - from), (int) (o - from),
+                       (int) (MIN (to, last) - o), &regs, (int) (to - from)) >= 0)
+        {
+          *start = from + match_start;
+          *end = from + match_end;
+          return true;
+        }
+      if (to == src->size || to >= last || stopped (wp->sp))
+        return false;
+      o = MAX (line_start (src, o, to), o + 1);
+    }
+}
+
+// Find the first match of the regexp of `wp' in `src' at or after `o',
+// only in the runs of text where the trigram index of its buffer, if
+// it has one, finds the prefix of the regexp.
+static bool
+find_match (struct worker *wp, struct source *src, size_t o, size_t *start, size_t *end)
+{
+  struct scan *sp = wp->sp;
+  TrigramIndex ti = src->bp != NULL ? get_buffer_trigrams (src->bp) : NULL;
+  for (size_t last = SIZE_MAX; o < src->size && !stopped (sp); o = last)
+    {
+      if (ti != NULL)
+        o = trigram_next (ti, o, sp->prefix, sp->prefix_len, sp->icase, &last);
+      if (o < src->size && find_in_run (wp, src, o, last, start, end))
+        return true;
+    }
+  return false;
+}
+
+// Return the slot for the next hit of `wp', waiting for one to be
+// read, or NULL if the scan is cut short.
+static struct hit *
+new_hit (struct worker *wp)
+{
+  struct scan *sp = wp->sp;
+  pthread_mutex_lock (&sp->lock);
+  while (wp->head - wp->tail == OCCUR_SLOTS && !sp->stop)
+    pthread_cond_wait (&sp->cond, &sp->lock);
+  struct hit *hp = sp->stop ? NULL : &wp->hits[wp->head % OCCUR_SLOTS];
+  pthread_mutex_unlock (&sp->lock);
+  return hp;
+}
+
+static void
+post_hit (struct worker *wp)
+{
+  pthread_mutex_lock (&wp->sp->lock);
+  wp->head++;
+  pthread_cond_broadcast (&wp->sp->cond);
+  pthread_mutex_unlock (&wp->sp->lock);
+}
+
+// List the lines of source `k' that match, mapping it first if it is
+// a file.
+static void
+scan_source (struct worker *wp, size_t k)
+{
+  struct source *src = &wp->sp->sources[k];
+  void *map = NULL;
+  if (src->filename != NULL)
+    {
+      int fd = open (src->filename, O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      if (fd >= 0 && fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0
+          && (map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+        {
+          src->s = (const char *) map;
+          src->size = st.st_size;
+        }
+      else
+        map = NULL;
+      if (fd >= 0)
+        close (fd);
+    }
+
+  size_t line = 1, counted = 0, n = 0;
+  struct hit *hp;
+  for (size_t o = 0, start, end;
+       o < src->size && !stopped (wp->sp) && find_match (wp, src, o, &start, &end);)
+    {
+      size_t from = line_start (src, o, start), len;
+      line += count_lines (src, counted, from);
+      counted = from;
+      if ((hp = new_hit (wp)) == NULL)
+        break;
+
+      /* Copy the start of the line, without cutting a character. */
+      size_t to = line_end (src, start), max = MIN (to - from, OCCUR_LINE_MAX);
+      *hp = (struct hit) { k, line, start, 0 };
+      for (; hp->len < max; hp->len += len)
+        {
+          const char *s = segment (src, from + hp->len, &len);
+          len = MIN (len, max - hp->len);
+          memcpy (hp->text + hp->len, s, len);
+        }
+      if (max < to - from)
+        while (hp->len > 0 && (*segment (src, from + hp->len, &len) & 0xc0) == 0x80)
+          hp->len--;
+      else if (hp->len > 0 && hp->text[hp->len - 1] == '\r')
+        hp->len--;
+      post_hit (wp);
+      n++;
+
+      /* Go on from the line after the end of the match. */
+      o = line_end (src, MAX (start, end - (end > start))) + 1;
+    }
+
+  if (map != NULL)
+    munmap (map, src->size);
+  if ((hp = new_hit (wp)) != NULL)
+    {
+      *hp = (struct hit) { k, 0, n, 0 };
+      post_hit (wp);
+    }
+}
+
+static void *
+worker (void *arg)
+{
+  struct worker *wp = (struct worker *) arg;
+  struct scan *sp = wp->sp;
+  pthread_mutex_lock (&sp->lock);
+  while (sp->next < sp->nsources && !sp->stop)
+    {
+      size_t k = sp->next++;
+      sp->sources[k].thread = wp->index;
+      pthread_cond_broadcast (&sp->cond);
+      pthread_mutex_unlock (&sp->lock);
+      scan_source (wp, k);
+      pthread_mutex_lock (&sp->lock);
+    }
+  pthread_mutex_unlock (&sp->lock);
+  return NULL;
+}
+
+// Forget the matches listed in `bp'.
+void
+stop_occur (Buffer bp)
+{
+  Occur op = get_buffer_occur (bp);
+  if (op == NULL)
+    return;
+
+  set_buffer_occur (bp, NULL);
+  for (size_t i = 0; i < gl_list_size (op->matches); i++)
+    {
+      struct match *mp = (struct match *) gl_list_get_at (op->matches, i);
+      if (mp != NULL && mp->marker != NULL)
+        unchain_marker (mp->marker);
+    }
+}
+
+// Write the header of `src' at `o', the end of the buffer, or once it
+// is done, with its `n' matches, over the one written there.
+static void
+write_header (struct source *src, const char *regexp, bool done, size_t n, size_t o)
+{
+  astr as = done ? astr_fmt ("%zu match%s", n, n == 1 ? "" : "es") : astr_new_cstr ("Matches");
+  astr_cat (as, astr_fmt (" for \"%s\" in %s: %s", regexp,
+                          src->bp != NULL ? "buffer" : "file",
+                          src->bp != NULL ? get_buffer_name (src->bp)
+                          : astr_cstr (compact_path (astr_new_cstr (src->filename)))));
+  set_buffer_pt (global.cur_bp, o);
+  if (done)
+    replace_estr (buffer_line_len (global.cur_bp, o), estr_new (as, coding_eol_lf));
+  else
+    insert_estr (estr_new (astr_cat_char (as, '\n'), coding_eol_lf));
+  set_buffer_pt (global.cur_bp, get_buffer_size (global.cur_bp));
+}
+
+/*
+ * Search the sources of `sp' for `regexp' on a pool of threads, and
+ * list the matches in the current buffer as they arrive, in the order
+ * of the sources, redrawing the screen as they do, until all have been
+ * searched or C-g is typed.  Return the number of matches, or
+ * SIZE_MAX if no thread could be started.
+ */
+static size_t
+run_scan (struct scan *sp, const char *regexp)
+{
+  Occur op = XZALLOC (struct Occur);
+  op->matches = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  set_buffer_occur (global.cur_bp, op);
+  set_buffer_key (global.cur_bp, "\\RET", F_occur_mode_goto_occurrence);
+  eolscan_isa ();
+
+  /* Keep signals for the main thread. */
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  pthread_t *threads = (pthread_t *) XCALLOC (sp->nworkers, pthread_t);
+  size_t started = 0;
+  for (size_t i = 0; i < sp->nworkers; i++)
+    if (pthread_create (&threads[started], NULL, worker, &sp->workers[i]) == 0)
+      started++;
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  if (started == 0)
+    {
+      minibuf_error ("Cannot start the search threads");
+      return SIZE_MAX;
+    }
+
+  /* Keys typed meanwhile, kept for after the scan. */
+  gl_list_t keys = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  size_t total = 0, n = 0, header = 0;
+  struct timeval next_refresh = { 0, 0 }, now;
+  struct timeval refresh_wait = { 0, OCCUR_REFRESH_MS * 1000 };
+  pthread_mutex_lock (&sp->lock);
+  for (size_t k = 0; k < sp->nsources && !sp->stop;)
+    {
+      /* Show what has been listed so far, and watch for C-g. */
+      gettimeofday (&now, NULL);
+      if (!timercmp (&now, &next_refresh, <))
+        {
+          pthread_mutex_unlock (&sp->lock);
+          term_redisplay ();
+          term_refresh ();
+          size_t key;
+          while ((key = getkeystroke (0)) != KBD_NOKEY && key != KBD_CANCEL)
+            gl_list_add_last (keys, (void *) key);
+          pthread_mutex_lock (&sp->lock);
+          if (key == KBD_CANCEL)
+            {
+              sp->stop = true;
+              pthread_cond_broadcast (&sp->cond);
+              break;
+            }
+          gettimeofday (&now, NULL);
+          timeradd (&now, &refresh_wait, &next_refresh);
+        }
+
+      struct source *src = &sp->sources[k];
+      struct worker *wp = src->thread != SIZE_MAX ? &sp->workers[src->thread] : NULL;
+      if (wp == NULL || wp->tail == wp->head)
+        {
+          struct timespec ts = { next_refresh.tv_sec, next_refresh.tv_usec * 1000 };
+          pthread_cond_timedwait (&sp->cond, &sp->lock, &ts);
+          continue;
+        }
+
+      struct hit *hp = &wp->hits[wp->tail % OCCUR_SLOTS];
+      pthread_mutex_unlock (&sp->lock);
+      if (hp->line == 0)
+        {
+          if (hp->o > 0)
+            write_header (src, regexp, true, hp->o, header);
+          total += hp->o;
+          n = 0;
+          k++;
+        }
+      else
+        {
+          if (n++ == 0)
+            {
+              header = get_buffer_pt (global.cur_bp);
+              write_header (src, regexp, false, 0, header);
+              gl_list_add_last (op->matches, NULL);
+            }
+          struct match *mp = XZALLOC (struct match);
+          mp->o = hp->o;
+          if (src->bp != NULL)
+            {
+              mp->marker = marker_new ();
+              move_marker (mp->marker, src->bp, hp->o);
+            }
+          else
+            mp->filename = src->filename;
+          gl_list_add_last (op->matches, mp);
+          astr as = astr_fmt ("%7zu:", hp->line);
+          astr_cat_nstr (as, hp->text, hp->len);
+          insert_estr (estr_new (astr_cat_char (as, '\n'), coding_eol_lf));
+        }
+      pthread_mutex_lock (&sp->lock);
+      wp->tail++;
+      pthread_cond_broadcast (&sp->cond);
+    }
+  pthread_mutex_unlock (&sp->lock);
+
+  for (size_t i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+  for (size_t i = gl_list_size (keys); i > 0; i--)
+    ungetkey ((size_t) gl_list_get_at (keys, i - 1));
+  return total;
+}
+
+static void
+write_occur (va_list ap)
+{
+  struct scan *sp = va_arg (ap, struct scan *);
+  const char *regexp = va_arg (ap, const char *);
+  size_t *total = va_arg (ap, size_t *);
+  *total = run_scan (sp, regexp);
+}
+
+/*
+ * List the lines of `sources', a list of buffers if `buffers' and
+ * else of file names, that match `regexp' in the *Occur* buffer.
+ */
+static le *
+occur (gl_list_t sources, bool buffers, const_astr regexp)
+{
+  if (regexp == NULL)
+    return FUNCALL (keyboard_quit);
+  size_t nsources = gl_list_size (sources);
+  for (size_t i = 0; i < nsources && buffers; i++)
+    if (get_buffer_occur ((Buffer) gl_list_get_at (sources, i)) != NULL)
+      {
+        minibuf_error ("Cannot search an *Occur* buffer");
+        return leNIL;
+      }
+
+  reg_syntax_t syntax = RE_SYNTAX_EMACS;
+  if (get_variable_bool ("case-fold-search")
+      && no_upper (astr_cstr (regexp), astr_len (regexp), true))
+    syntax |= RE_ICASE;
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  struct scan scan = {
+    .nsources = nsources,
+    .nworkers = MAX (MIN (cpus, OCCUR_THREADS), 1),
+    .ap = automaton_new (astr_cstr (regexp), astr_len (regexp), syntax & RE_ICASE),
+    .prefix = astr_cstr (regexp),
+    .prefix_len = regex_prefix_len (astr_cstr (regexp), astr_len (regexp)),
+    .icase = syntax & RE_ICASE,
+  };
+  if (!STREQ (get_variable ("regexp-engine"), "dfa"))
+    scan.ap = NULL;
+
+  /* Make everything the threads use beforehand. */
+  scan.sources = (struct source *) XCALLOC (nsources, struct source);
+  for (size_t i = 0; i < nsources; i++)
+    {
+      struct source *src = &scan.sources[i];
+      src->thread = SIZE_MAX;
+      if (!buffers)
+        src->filename = (const char *) gl_list_get_at (sources, i);
+      else
+        {
+          src->bp = (Buffer) gl_list_get_at (sources, i);
+          src->size = get_buffer_size (src->bp);
+          /* The regex library needs the text in one piece. */
+          if (scan.ap == NULL)
+            src->s = get_buffer_contiguous (src->bp, 0, src->size);
+        }
+    }
+  scan.workers = (struct worker *) XCALLOC (scan.nworkers, struct worker);
+  for (size_t i = 0; i < scan.nworkers; i++)
+    {
+      struct worker *wp = &scan.workers[i];
+      wp->sp = &scan;
+      wp->index = i;
+      wp->hits = (struct hit *) XCALLOC (OCCUR_SLOTS, struct hit);
+      if (scan.ap == NULL)
+        {
+          wp->pattern.fastmap = (char *) xmalloc (UCHAR_MAX + 1);
+          re_set_syntax (syntax);
+          const char *err = re_compile_pattern (astr_cstr (regexp), (int) astr_len (regexp),
+                                                &wp->pattern);
+          if (err != NULL)
+            {
+              minibuf_error ("%s", err);
+              return leNIL;
+            }
+          wp->pattern.regs_allocated = REGS_FIXED;
+        }
+    }
+  if (scan.ap != NULL)
+    automaton_threads (scan.ap, scan.nworkers);
+  pthread_mutex_init (&scan.lock, NULL);
+  pthread_cond_init (&scan.cond, NULL);
+
+  size_t total = 0;
+  write_temp_buffer ("*Occur*", true, write_occur, &scan, astr_cstr (regexp), &total);
+
+  pthread_cond_destroy (&scan.cond);
+  pthread_mutex_destroy (&scan.lock);
+  for (size_t i = 0; i < scan.nworkers && scan.ap == NULL; i++)
+    {
+      free (scan.workers[i].pattern.fastmap);
+      scan.workers[i].pattern.fastmap = NULL;
+      regfree (&scan.workers[i].pattern);
+    }
+
+  if (total == SIZE_MAX)
+    return leNIL;
+  if (scan.stop)
+    return FUNCALL (keyboard_quit);
+  minibuf_write ("Searched %zu %s%s; %zu match%s for `%s'", nsources,
+                 buffers ? "buffer" : "file", nsources == 1 ? "" : "s",
+                 total, total == 1 ? "" : "es", astr_cstr (regexp));
+  return bool_to_lisp (total > 0);
+}
+
+DEFUN_ARGS ("occur", occur,
+            STR_ARG (regexp))
+/*+
+Show all lines in the current buffer containing a match for @i{regexp}.
+The lines are listed in the buffer `*Occur*', with their line numbers,
+as they are found; @kbd{RET} on one of them goes to the match.
++*/
+{
+  STR_INIT (regexp)
+  else
+    regexp = minibuf_read ("List lines matching regexp: ", "");
+  gl_list_t sources = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  gl_list_add_last (sources, global.cur_bp);
+  ok = occur (sources, true, regexp);
+}
+END_DEFUN
+
+DEFUN_ARGS ("multi-occur", multi_occur,
+            STR_ARG (bufregexp)
+            STR_ARG (regexp))
+/*+
+Show all lines in the buffers whose names match @i{bufregexp} that
+contain a match for @i{regexp}, as `occur' does for one buffer.
+Buffers whose names start with a space are not searched.
++*/
+{
+  STR_INIT (bufregexp)
+  else
+    bufregexp = minibuf_read ("List lines in buffers whose names match regexp: ", "");
+  if (bufregexp == NULL)
+    return FUNCALL (keyboard_quit);
+  STR_INIT (regexp)
+  else
+    regexp = minibuf_read ("List lines matching regexp: ", "");
+
+  struct re_pattern_buffer pattern = { 0 };
+  re_set_syntax (RE_SYNTAX_EMACS);
+  const char *err = re_compile_pattern (astr_cstr (bufregexp), (int) astr_len (bufregexp), &pattern);
+  if (err != NULL)
+    {
+      minibuf_error ("%s", err);
+      return leNIL;
+    }
+  gl_list_t sources = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  for (Buffer bp = global.head_bp; bp != NULL; bp = get_buffer_next (bp))
+    {
+      const char *name = get_buffer_name (bp);
+      if (name[0] != ' ' && get_buffer_occur (bp) == NULL
+          && re_search (&pattern, name, (int) strlen (name), 0, (int) strlen (name), NULL) >= 0)
+        gl_list_add_last (sources, bp);
+    }
+  regfree (&pattern);
+  ok = occur (sources, true, regexp);
+}
+END_DEFUN
+
+static int
+compare_names (const void *a, const void *b)
+{
+  return strcmp (*(const char * const *) a, *(const char * const *) b);
+}
+
+// Add to `files' the regular files under `path', in order.
+static void
+add_files (gl_list_t files, const char *path)
+{
+  struct stat st;
+  if (lstat (path, &st) != 0)
+    return;
+  if (S_ISREG (st.st_mode))
+    gl_list_add_last (files, path);
+  else if (S_ISDIR (st.st_mode))
+    {
+      DIR *dir = opendir (path);
+      if (dir == NULL)
+        return;
+      gl_list_t names = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+      for (struct dirent *d; (d = readdir (dir)) != NULL;)
+        if (!STREQ (d->d_name, ".") && !STREQ (d->d_name, ".."))
+          gl_list_add_last (names, xasprintf ("%s%s%s", path,
+                                              path[strlen (path) - 1] == '/' ? "" : "/",
+                                              d->d_name));
+      closedir (dir);
+
+      size_t n = gl_list_size (names);
+      const char **v = (const char **) XNMALLOC (n, const char *);
+      for (size_t i = 0; i < n; i++)
+        v[i] = (const char *) gl_list_get_at (names, i);
+      qsort (v, n, sizeof (*v), compare_names);
+      for (size_t i = 0; i < n; i++)
+        add_files (files, v[i]);
+    }
+}
+
+DEFUN_ARGS ("grep-files", grep_files,
+            STR_ARG (files)
+            STR_ARG (regexp))
+/*+
+Show all lines in the files that match the wildcard pattern @i{files}
+that contain a match for @i{regexp}, as `occur' does for a buffer.
+The directories that match are searched recursively.  The files are
+searched as they are on disk, even if they are visited.
++*/
+{
+  STR_INIT (files)
+  else
+    files = minibuf_read_filename ("Search files: ", astr_cstr (get_buffer_dir (global.cur_bp)),
+                                   NULL);
+  if (files == NULL)
+    return FUNCALL (keyboard_quit);
+  STR_INIT (regexp)
+  else
+    regexp = minibuf_read ("List lines matching regexp: ", "");
+
+  astr pattern = astr_cpy (astr_new (), files);
+  expand_path (pattern);
+  glob_t g;
+  gl_list_t sources = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+  if (glob (astr_cstr (pattern), 0, NULL, &g) == 0)
+    {
+      for (size_t i = 0; i < g.gl_pathc; i++)
+        add_files (sources, xstrdup (g.gl_pathv[i]));
+      globfree (&g);
+    }
+  if (gl_list_size (sources) == 0)
+    {
+      minibuf_error ("No files match `%s'", astr_cstr (files));
+      return leNIL;
+    }
+  ok = occur (sources, false, regexp);
+}
+END_DEFUN
+
+DEFUN ("occur-mode-goto-occurrence", occur_mode_goto_occurrence)
+/*+
+Go to the match listed on the current line of the `*Occur*' buffer,
+in another window.  A file is visited if it is not yet, and then the
+matches listed in it are followed as it is edited.
++*/
+{
+  Occur op = get_buffer_occur (global.cur_bp);
+  size_t line = offset_to_line (global.cur_bp, get_buffer_pt (global.cur_bp));
+  struct match *mp = op != NULL && line < gl_list_size (op->matches)
+    ? (struct match *) gl_list_get_at (op->matches, line) : NULL;
+  if (mp == NULL)
+    {
+      minibuf_error ("No occurrence on this line");
+      return leNIL;
+    }
+
+  Buffer bp = NULL;
+  if (mp->marker != NULL)
+    {
+      for (bp = global.head_bp; bp != NULL && bp != get_marker_bp (mp->marker);
+           bp = get_buffer_next (bp))
+        ;
+      if (bp == NULL)
+        {
+          minibuf_error ("Buffer in which occurrence was found is deleted");
+          return leNIL;
+        }
+    }
+
+  set_current_window (popup_window ());
+  if (bp != NULL)
+    switch_to_buffer (bp);
+  else
+    {
+      if (!find_file (mp->filename, false))
+        return leNIL;
+      size_t size = get_buffer_size (global.cur_bp);
+      for (size_t i = 0; i < gl_list_size (op->matches); i++)
+        {
+          struct match *p = (struct match *) gl_list_get_at (op->matches, i);
+          if (p != NULL && p->marker == NULL && STREQ (p->filename, mp->filename))
+            {
+              p->marker = marker_new ();
+              move_marker (p->marker, global.cur_bp, MIN (p->o, size));
+            }
+        }
+    }
+  goto_offset (get_marker_o (mp->marker));
+}
+END_DEFUN
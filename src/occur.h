@@ -0,0 +1,41 @@
+#ifndef OCCUR_H
+#define OCCUR_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+
+/*
+ * The lines that match a regexp in some buffers or files are listed in
+ * the *Occur* buffer.  The sources are searched by a pool of up to
+ * OCCUR_THREADS threads, each of which hands its matches over through
+ * a ring of OCCUR_SLOTS slots, allocated beforehand, as the threads
+ * must not allocate from the collector.  The main thread lists the
+ * matches in the order of the sources as they arrive, redrawing the
+ * screen as it goes.
+ */
+
+#define OCCUR_THREADS 8
+#define OCCUR_SLOTS 256
+
+/* The longest text of a line listed. */
+#define OCCUR_LINE_MAX 512
+
+void stop_occur (Buffer bp);
+
+#endif
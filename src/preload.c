@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "preload.h"
+#include "eolscan.h"
+
+struct job
+{
+  char *filename;
+  astr as;           /* The text, read into its reserved space. */
+  const char *eol;   /* The EOL type of the text. */
+  bool ok;           /* The whole file was read. */
+  bool done;         /* The job is finished. */
+};
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  struct job *jobs;  /* The files being preloaded. */
+  size_t njobs;
+  size_t next;       /* The first job not started. */
+  size_t finished;   /* The number of jobs finished. */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+
+// Read the file of `jp' into the space reserved for it.
+static void
+run_job (struct job *jp)
+{
+  int fd = open (jp->filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  size_t len = 0, size = jp->as->maxlen;
+  ssize_t n;
+  char c;
+  while (len < size && ((n = read (fd, jp->as->text + len, size - len)) > 0
+                        || (n < 0 && errno == EINTR)))
+    len += MAX (n, 0);
+
+  /* A file that grew since it was measured is left to the main thread. */
+  while ((n = read (fd, &c, 1)) < 0 && errno == EINTR)
+    ;
+  close (fd);
+
+  jp->ok = n == 0;
+  jp->as->len = len;
+  jp->eol = estr_detect_eol (jp->as->text, len);
+}
+
+static void *
+worker (void *arg _GL_UNUSED_PARAMETER)
+{
+  pthread_mutex_lock (&pool.lock);
+  while (pool.next < pool.njobs)
+    {
+      struct job *jp = &pool.jobs[pool.next++];
+      pthread_mutex_unlock (&pool.lock);
+      run_job (jp);
+      pthread_mutex_lock (&pool.lock);
+      jp->done = true;
+      pool.finished++;
+      pthread_cond_broadcast (&pool.done);
+    }
+  pthread_mutex_unlock (&pool.lock);
+  return NULL;
+}
+
+/*
+ * Start reading in the background the regular files of `filenames'
+ * no bigger than `limit' bytes.  Preloading is done once, for the
+ * files given together; a second call while it goes on does nothing.
+ * The jobs are only replaced once every one is finished: until then a
+ * thread may still be reading into a string that only the pool keeps
+ * reachable for the collector, which does not see the threads.
+ */
+void
+preload_files (gl_list_t filenames, size_t limit)
+{
+  pthread_mutex_lock (&pool.lock);
+  bool busy = pool.finished < pool.njobs;
+  pthread_mutex_unlock (&pool.lock);
+  if (busy)
+    return;
+
+  size_t n = gl_list_size (filenames), njobs = 0;
+  struct job *jobs = (struct job *) XCALLOC (n, struct job);
+  for (size_t i = 0; i < n; i++)
+    {
+      const char *filename = (const char *) gl_list_get_at (filenames, i);
+      struct stat st;
+      if (stat (filename, &st) == 0 && S_ISREG (st.st_mode) && (size_t) st.st_size <= limit)
+        jobs[njobs++] = (struct job) {
+          .filename = xstrdup (filename),
+          .as = astr_reserve (astr_new (), st.st_size),
+        };
+    }
+  if (njobs < 2)
+    return;
+
+  /* Select the EOL scanning kernels before the threads use them. */
+  eolscan_isa ();
+
+  pthread_mutex_lock (&pool.lock);
+  pool.jobs = jobs;
+  pool.njobs = njobs;
+  pool.next = 0;
+  pool.finished = 0;
+  pthread_mutex_unlock (&pool.lock);
+
+  /* Keep signals for the main thread. */
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  for (size_t i = 0; i < MIN (njobs, (size_t) MAX (MIN (cpus, PRELOAD_THREADS), 1)); i++)
+    {
+      pthread_t thread;
+      if (pthread_create (&thread, NULL, worker, NULL) == 0)
+        pthread_detach (thread);
+    }
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Return the text of `filename' if it is being preloaded, once it has
+ * been read, or NULL if it is not, or could not be read in full.
+ */
+estr
+preload_take (const char *filename)
+{
+  pthread_mutex_lock (&pool.lock);
+  struct job *jp = NULL;
+  for (size_t i = 0; i < pool.njobs && jp == NULL; i++)
+    if (pool.jobs[i].filename && STREQ (pool.jobs[i].filename, filename))
+      jp = &pool.jobs[i];
+
+  /* Read the file here if no thread has started on it yet. */
+  if (jp && pool.next < pool.njobs && jp == &pool.jobs[pool.next])
+    {
+      pool.next++;
+      pthread_mutex_unlock (&pool.lock);
+      run_job (jp);
+      pthread_mutex_lock (&pool.lock);
+      jp->done = true;
+      pool.finished++;
+    }
+  while (jp && !jp->done)
+    pthread_cond_wait (&pool.done, &pool.lock);
+
+  /* Hand the text over, so the pool does not keep it alive. */
+  struct job job = { NULL, NULL, NULL, false, false };
+  if (jp)
+    {
+      job = *jp;
+      jp->filename = NULL;
+      jp->as = NULL;
+    }
+  pthread_mutex_unlock (&pool.lock);
+
+  if (!job.ok)
+    return NULL;
+  astr_set_len (job.as, job.as->len);
+  return estr_take (job.as, job.eol);
+}
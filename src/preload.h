@@ -0,0 +1,36 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+
+/*
+ * Files about to be visited together are read by a pool of up to
+ * PRELOAD_THREADS threads, which also detect their EOL type, while the
+ * editor goes on visiting them in order on the main thread.  The
+ * threads only read into strings allocated beforehand by the main
+ * thread, as they must not allocate from the collector.
+ */
+
+#define PRELOAD_THREADS 8
+
+void preload_files (gl_list_t filenames, size_t limit);
+estr preload_take (const char *filename);
+
+#endif
@@ -91,7 +91,8 @@ resize_windows (void)
 void
 recenter (Window wp)
 {
-  size_t n = offset_to_line (get_window_bp (wp), window_o (wp));
+  bool exact;
+  size_t n = estimate_offset_line (get_window_bp (wp), window_o (wp), &exact);
 
   if (n > get_window_eheight (wp) / 2)
     set_window_topdelta (wp, get_window_eheight (wp) / 2);
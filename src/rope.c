@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "xalloc.h"
+#include "minmax.h"
+#include "size_max.h"
+
+#include "rope.h"
+#include "eolscan.h"
+
+typedef struct RopeNode *RopeNode;
+
+struct RopeNode
+{
+  RopeNode left, right;
+  unsigned prio;   /* Heap priority of the treap. */
+  size_t size;     /* Text size of the whole subtree. */
+  char *text;      /* The chunk. */
+  size_t len;      /* Used bytes of the chunk. */
+  size_t cap;      /* Allocated bytes of the chunk, 0 if it is mapped. */
+};
+
+struct Rope
+{
+  RopeNode root;
+  size_t chunks;   /* Number of nodes. */
+  unsigned seed;   /* State of the priority generator. */
+  char *map;       /* The file mapping the chunks point into, or NULL. */
+  size_t map_len;  /* Size of the mapping. */
+  dev_t dev;       /* Device and inode of the mapped file. */
+  ino_t ino;
+};
+
+#define SIZE(t) ((t) ? (t)->size : 0)
+
+static size_t mapped_bytes;   /* Bytes of all the live mappings. */
+static size_t copied_bytes;   /* Bytes copied out of a mapping on edits. */
+
+static unsigned
+rope_random (Rope r)
+{
+  /* xorshift32: priorities only need to be well spread. */
+  r->seed ^= r->seed << 13;
+  r->seed ^= r->seed >> 17;
+  r->seed ^= r->seed << 5;
+  return r->seed;
+}
+
+static RopeNode
+node_new (Rope r, const char *s, size_t len)
+{
+  RopeNode n = XZALLOC (struct RopeNode);
+  n->prio = rope_random (r);
+  n->cap = MAX (len, 1);
+  n->text = xmalloc (n->cap);
+  memcpy (n->text, s, len);
+  n->len = n->size = len;
+  r->chunks++;
+  return n;
+}
+
+/* Make a chunk pointing into the mapping instead of owning its text. */
+static RopeNode
+node_map (Rope r, const char *s, size_t len)
+{
+  RopeNode n = XZALLOC (struct RopeNode);
+  n->prio = rope_random (r);
+  n->text = (char *) s;
+  n->len = n->size = len;
+  r->chunks++;
+  return n;
+}
+
+/* Give a mapped chunk its own copy of the text, with room for `cap'
+   bytes. */
+static void
+node_unshare (RopeNode t, size_t cap)
+{
+  char *text = xmalloc (cap);
+  memcpy (text, t->text, t->len);
+  t->text = text;
+  t->cap = cap;
+  copied_bytes += t->len;
+}
+
+static inline void
+node_update (RopeNode t)
+{
+  t->size = SIZE (t->left) + t->len + SIZE (t->right);
+}
+
+static RopeNode
+node_merge (RopeNode a, RopeNode b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->prio > b->prio)
+    {
+      a->right = node_merge (a->right, b);
+      node_update (a);
+      return a;
+    }
+  b->left = node_merge (a, b->left);
+  node_update (b);
+  return b;
+}
+
+/* Split `t' so that `*l' holds its first `o' bytes and `*r' the rest,
+   cutting a chunk in two if needed. */
+static void
+node_split (Rope r, RopeNode t, size_t o, RopeNode *l, RopeNode *rt)
+{
+  if (t == NULL)
+    {
+      *l = *rt = NULL;
+      return;
+    }
+
+  size_t lsize = SIZE (t->left);
+  if (o <= lsize)
+    {
+      node_split (r, t->left, o, l, &t->left);
+      node_update (t);
+      *rt = t;
+    }
+  else if (o >= lsize + t->len)
+    {
+      node_split (r, t->right, o - lsize - t->len, &t->right, rt);
+      node_update (t);
+      *l = t;
+    }
+  else
+    {
+      size_t k = o - lsize;
+      RopeNode tail = (t->cap ? node_new : node_map) (r, t->text + k, t->len - k);
+      t->len = k;
+      *rt = node_merge (tail, t->right);
+      t->right = NULL;
+      node_update (t);
+      *l = t;
+    }
+}
+
+/* Find the node holding offset `o'; an offset on a boundary belongs
+   to the chunk it ends, so that appending grows that chunk. */
+static RopeNode
+node_find (RopeNode t, size_t o, size_t *start)
+{
+  size_t base = 0;
+  while (t != NULL)
+    {
+      size_t lsize = SIZE (t->left);
+      if (t->left != NULL && o <= lsize)
+        t = t->left;
+      else if (o <= lsize + t->len || t->right == NULL)
+        {
+          *start = base + lsize;
+          return t;
+        }
+      else
+        {
+          o -= lsize + t->len;
+          base += lsize + t->len;
+          t = t->right;
+        }
+    }
+  return NULL;
+}
+
+/* Try to perform the edit inside a single chunk, fixing up the sizes
+   on the way back; return false if it does not fit. */
+static bool
+node_edit (RopeNode t, size_t o, size_t del, const char *s, size_t len)
+{
+  if (t == NULL)
+    return false;
+
+  size_t lsize = SIZE (t->left);
+  bool done;
+  if (t->left != NULL && o <= lsize)
+    done = o + del <= lsize && node_edit (t->left, o, del, s, len);
+  else if (o <= lsize + t->len)
+    {
+      size_t k = o - lsize, newlen = t->len - del + len;
+      done = k + del <= t->len && newlen > 0 && newlen <= ROPE_CHUNK_MAX;
+      if (done)
+        {
+          if (t->cap == 0)
+            node_unshare (t, MIN (MAX (newlen, t->len), ROPE_CHUNK_MAX));
+          else if (newlen > t->cap)
+            {
+              t->cap = MIN (MAX (newlen, t->cap * 2), ROPE_CHUNK_MAX);
+              t->text = xrealloc (t->text, t->cap);
+            }
+          memmove (t->text + k + len, t->text + k + del, t->len - k - del);
+          memcpy (t->text + k, s, len);
+          t->len = newlen;
+        }
+    }
+  else
+    done = node_edit (t->right, o - lsize - t->len, del, s, len);
+
+  if (done)
+    t->size = t->size - del + len;
+  return done;
+}
+
+/* Build a subtree out of the text `s'. */
+static RopeNode
+node_build (Rope r, const char *s, size_t len)
+{
+  RopeNode t = NULL;
+  for (size_t i = 0; i < len; i += ROPE_CHUNK_SIZE)
+    t = node_merge (t, node_new (r, s + i, MIN (ROPE_CHUNK_SIZE, len - i)));
+  return t;
+}
+
+/* Copy the text of all the mapped chunks of a subtree. */
+static void
+node_unshare_all (RopeNode t)
+{
+  for (; t != NULL; t = t->right)
+    {
+      if (t->cap == 0)
+        node_unshare (t, MAX (t->len, 1));
+      node_unshare_all (t->left);
+    }
+}
+
+/* Forget the chunks of a subtree cut out of the rope. */
+static void
+node_discard (Rope r, RopeNode t)
+{
+  for (; t != NULL; t = t->right)
+    {
+      r->chunks--;
+      node_discard (r, t->left);
+    }
+}
+
+/* Join the two chunks around offset `o' when both are small, to keep
+   the number of chunks proportional to the text size. */
+static void
+rope_coalesce (Rope r, size_t o)
+{
+  size_t astart, bstart;
+  if (o == 0 || o >= SIZE (r->root))
+    return;
+  RopeNode a = node_find (r->root, o, &astart);
+  if (astart + a->len != o)
+    return;
+  RopeNode b = node_find (r->root, o + 1, &bstart);
+  if (a->len + b->len > ROPE_CHUNK_SIZE / 2)
+    return;
+
+  RopeNode x, yz, y, z;
+  node_split (r, r->root, astart, &x, &yz);
+  node_split (r, yz, a->len + b->len, &y, &z);
+  RopeNode n = node_new (r, a->text, a->len);
+  node_edit (n, a->len, 0, b->text, b->len);
+  r->chunks -= 2;
+  r->root = node_merge (node_merge (x, n), z);
+}
+
+// ================ Public ================================
+
+Rope
+rope_new (const char *s, size_t len)
+{
+  Rope r = XZALLOC (struct Rope);
+  r->seed = 2463534242u;
+  r->root = node_build (r, s, len);
+  return r;
+}
+
+Rope
+rope_new_mapped (const char *filename)
+{
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  char *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode)
+      && st.st_size > 0 && (uintmax_t) st.st_size <= SIZE_MAX)
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  Rope r = rope_new ("", 0);
+  r->map = map;
+  r->map_len = st.st_size;
+  r->dev = st.st_dev;
+  r->ino = st.st_ino;
+  for (size_t i = 0; i < r->map_len; i += ROPE_MAP_CHUNK)
+    r->root = node_merge (r->root, node_map (r, map + i, MIN (ROPE_MAP_CHUNK, r->map_len - i)));
+  mapped_bytes += r->map_len;
+  return r;
+}
+
+bool
+rope_maps (Rope r, const struct stat *st)
+{
+  return r->map != NULL && r->dev == st->st_dev && r->ino == st->st_ino;
+}
+
+bool
+rope_map_cut (Rope r, const struct stat *st)
+{
+  return rope_maps (r, st) && (uintmax_t) st->st_size < r->map_len;
+}
+
+void
+rope_unshare (Rope r)
+{
+  if (r->map == NULL)
+    return;
+  node_unshare_all (r->root);
+  rope_release (r);
+}
+
+void
+rope_release (Rope r)
+{
+  if (r->map == NULL)
+    return;
+  munmap (r->map, r->map_len);
+  mapped_bytes -= r->map_len;
+  r->map = NULL;
+}
+
+size_t
+rope_mapped_bytes (size_t *copied)
+{
+  *copied = copied_bytes;
+  return mapped_bytes;
+}
+
+size_t
+rope_len (Rope r)
+{
+  return SIZE (r->root);
+}
+
+size_t
+rope_chunks (Rope r)
+{
+  return r->chunks;
+}
+
+char
+rope_get (Rope r, size_t o)
+{
+  size_t start;
+  RopeNode t = node_find (r->root, o + 1, &start);
+  return t && o < start + t->len ? t->text[o - start] : '\0';
+}
+
+const char *
+rope_segment (Rope r, size_t o, size_t *len)
+{
+  size_t start;
+  RopeNode t = node_find (r->root, o + 1, &start);
+  if (t == NULL || o >= start + t->len)
+    {
+      *len = 0;
+      return NULL;
+    }
+  *len = t->len - (o - start);
+  return t->text + (o - start);
+}
+
+const char *
+rope_segment_before (Rope r, size_t o, size_t *len)
+{
+  size_t start;
+  RopeNode t = o > 0 ? node_find (r->root, o, &start) : NULL;
+  if (t == NULL)
+    {
+      *len = 0;
+      return NULL;
+    }
+  *len = o - start;
+  return t->text;
+}
+
+void
+rope_copy (Rope r, size_t o, size_t n, char *dest)
+{
+  while (n > 0)
+    {
+      size_t len;
+      const char *s = rope_segment (r, o, &len);
+      len = MIN (len, n);
+      memcpy (dest, s, len);
+      dest += len;
+      o += len;
+      n -= len;
+    }
+}
+
+void
+rope_replace (Rope r, size_t o, size_t del, const char *s, size_t len)
+{
+  if (node_edit (r->root, o, del, s, len))
+    return;
+
+  RopeNode a, bc, b, c;
+  node_split (r, r->root, o, &a, &bc);
+  node_split (r, bc, del, &b, &c);
+  node_discard (r, b);
+  r->root = node_merge (node_merge (a, node_build (r, s, len)), c);
+
+  rope_coalesce (r, o + len);
+  rope_coalesce (r, o);
+}
+
+static bool
+rope_match (Rope r, size_t o, const char *t, size_t tlen)
+{
+  for (size_t i = 0; i < tlen; i++)
+    if (rope_get (r, o + i) != t[i])
+      return false;
+  return true;
+}
+
+size_t
+rope_find_eol (Rope r, size_t o, const char *eol)
+{
+  size_t size = SIZE (r->root), eol_len = strlen (eol);
+  for (size_t n; o + eol_len <= size; o += n)
+    {
+      const char *s = rope_segment (r, o, &n);
+      const char *next = eolscan_find (s, n, eol);
+      if (next)
+        return o + (next - s);
+
+      /* An EOL straddling the end of the chunk. */
+      if (eol_len == 2 && s[n - 1] == eol[0] && o + n < size && rope_match (r, o + n - 1, eol, 2))
+        return o + n - 1;
+    }
+  return SIZE_MAX;
+}
+
+size_t
+rope_rfind_eol (Rope r, size_t o, const char *eol)
+{
+  size_t eol_len = strlen (eol);
+  for (size_t end = o, n; end > 0; end -= n)
+    {
+      const char *s = rope_segment_before (r, end, &n);
+
+      /* An EOL straddling the end of the chunk comes last. */
+      if (eol_len == 2 && end < o && s[n - 1] == eol[0] && rope_match (r, end - 1, eol, 2))
+        return end - 1;
+
+      const char *prev = eolscan_rfind (s, n, eol);
+      if (prev)
+        return end - n + (prev - s);
+    }
+  return SIZE_MAX;
+}
@@ -0,0 +1,83 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * A rope keeps the text as a sequence of chunks stored in a treap
+ * ordered by position; every node caches the size of its subtree, so
+ * locating an offset, splitting and joining cost O(log n) and an edit
+ * never moves more than one chunk worth of text.
+ *
+ * A rope can also be built over a read-only mapping of a file, whose
+ * chunks point into the mapping and are only copied when edited, so
+ * that opening a file costs no reads and its pages stay shared with
+ * the page cache.
+ */
+
+#define ROPE_CHUNK_SIZE 16384  /* Size of the chunks built from new text. */
+#define ROPE_CHUNK_MAX  32768  /* Chunks growing beyond this are split. */
+#define ROPE_MAP_CHUNK  1048576 /* Size of the chunks of a mapped file. */
+
+typedef struct Rope *Rope;
+
+Rope rope_new (const char *s, size_t len);
+
+/* Map the regular file `filename', returning NULL if it is empty or
+   cannot be mapped.  The file must not be truncated while mapped. */
+Rope rope_new_mapped (const char *filename);
+
+/* Whether the rope still maps the file described by `st'. */
+_GL_ATTRIBUTE_PURE bool rope_maps (Rope r, const struct stat *st);
+
+/* Whether the rope maps the file described by `st', which is now
+   shorter than the mapping. */
+_GL_ATTRIBUTE_PURE bool rope_map_cut (Rope r, const struct stat *st);
+
+/* Copy the text still in the mapping and drop the mapping. */
+void rope_unshare (Rope r);
+
+/* Drop the mapping of a rope no longer used. */
+void rope_release (Rope r);
+
+/* Bytes currently mapped, storing the bytes ever copied out of a
+   mapping by edits in `copied'. */
+size_t rope_mapped_bytes (size_t *copied);
+
+_GL_ATTRIBUTE_PURE size_t rope_len (Rope r);
+_GL_ATTRIBUTE_PURE size_t rope_chunks (Rope r);
+_GL_ATTRIBUTE_PURE char rope_get (Rope r, size_t o);
+
+/* Return the contiguous run of text starting at `o' (resp. ending at
+   `o'), storing its length in `len'. */
+const char *rope_segment (Rope r, size_t o, size_t *len);
+const char *rope_segment_before (Rope r, size_t o, size_t *len);
+
+void rope_copy (Rope r, size_t o, size_t n, char *dest);
+void rope_replace (Rope r, size_t o, size_t del, const char *s, size_t len);
+
+/* Offset of the first EOL starting at or after `o', or of the last
+   one ending at or before `o'; SIZE_MAX if there is none. */
+_GL_ATTRIBUTE_PURE size_t rope_find_eol (Rope r, size_t o, const char *eol);
+_GL_ATTRIBUTE_PURE size_t rope_rfind_eol (Rope r, size_t o, const char *eol);
+
+#endif
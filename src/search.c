@@ -23,7 +23,12 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include <regex.h>
+#include <signal.h>
+#include <unistd.h>
+#include "gl_array_list.h"
 
 #include "main.h"
 #include "extern.h"
@@ -35,10 +40,13 @@
 #include "variables.h"
 #include "getkey.h"
 #include "minibuf.h"
+#include "literal.h"
+#include "automaton.h"
+#include "eolscan.h"
 
 /* Return true if there are no upper-case letters in the given string.
    If `regex' is true, ignore escaped characters. */
-static bool
+bool
 no_upper (const char *s, size_t len, int regex)
 {
   int quote_flag = 0;
@@ -56,44 +64,625 @@ no_upper (const char *s, size_t len, int regex)
 
 static const char *re_find_err = NULL;
 
-static int
-find_substr (const_astr as, const char *n, size_t nsize,
-             bool forward, bool notbol, bool noteol, bool regex, bool icase, Region out)
+/*
+ * Compiled patterns are kept in a small cache, most recently used
+ * first, so that repeating a search, extending an incremental search
+ * or replacing each match does not compile the same pattern again.
+ */
+#define REGEX_CACHE_SIZE 16
+
+/* The size of the chunks searched forwards by a backward search. */
+#define SEARCH_CHUNK (64 * 1024)
+
+/* The size of the windows of text given at once to the regex library. */
+#define SEARCH_WINDOW ((size_t) 64 * 1024 * 1024)
+
+struct regex_entry
 {
-  int re_ret = -1;
+  astr text;                      /* The pattern. */
+  reg_syntax_t syntax;            /* The syntax it was compiled with. */
   struct re_pattern_buffer pattern;
-  struct re_registers search_regs;
-  reg_syntax_t syntax = RE_SYNTAX_EMACS;
+  Literal prefix;                 /* The text every match starts with, or NULL. */
+  size_t prefix_len;
+  Automaton automaton;            /* The automaton of the pattern, or NULL. */
+};
+
+static struct regex_entry *regex_cache[REGEX_CACHE_SIZE];
+static size_t regex_hits, regex_misses;
+
+static void
+free_regex (struct regex_entry *e)
+{
+  /* The fastmap is ours; the rest belongs to the regex library. */
+  free (e->pattern.fastmap);
+  e->pattern.fastmap = NULL;
+  regfree (&e->pattern);
+}
+
+/*
+ * Return the length of the text that every match of the regexp `n'
+ * starts with: its leading ordinary characters, or none if it has
+ * alternatives.  Only ASCII characters are taken, which fold to
+ * lower case the same in the regexp and in a Literal.
+ */
+size_t
+regex_prefix_len (const char *n, size_t nsize)
+{
+  for (size_t i = 0; i < nsize; i++)
+    if (n[i] == '\\' && ++i < nsize && n[i] == '|')
+      return 0;
+
+  size_t i;
+  for (i = 0; i < nsize && strchr (".*+?[^$\\", n[i]) == NULL && (unsigned char) n[i] < 0x80; i++)
+    ;
+  /* A character that may be repeated zero times is not needed; `+'
+     may be followed by other operators, as in `a+*'. */
+  size_t j;
+  for (j = i; j < nsize && n[j] == '+'; j++)
+    ;
+  if (i > 0 && j < nsize && (n[j] == '*' || n[j] == '?'
+                             || (n[j] == '\\' && j + 1 < nsize && n[j + 1] == '{')))
+    i--;
+  return i;
+}
+
+// Return the compiled regexp `n' of `nsize' bytes, or NULL, setting
+// `re_find_err', if it is not valid.
+static struct regex_entry *
+compile_regex (const char *n, size_t nsize, reg_syntax_t syntax)
+{
+  size_t i;
+  for (i = 0; i < REGEX_CACHE_SIZE && regex_cache[i] != NULL; i++)
+    if (regex_cache[i]->syntax == syntax && astr_len (regex_cache[i]->text) == nsize
+        && memcmp (astr_cstr (regex_cache[i]->text), n, nsize) == 0)
+      break;
+
+  struct regex_entry *e;
+  if (i < REGEX_CACHE_SIZE && regex_cache[i] != NULL)
+    {
+      e = regex_cache[i];
+      regex_hits++;
+    }
+  else
+    {
+      regex_misses++;
+      e = XZALLOC (struct regex_entry);
+      e->text = astr_cat_nstr (astr_new (), n, nsize);
+      e->syntax = syntax;
+      e->pattern.fastmap = (char *) xmalloc (UCHAR_MAX + 1);
+      re_set_syntax (syntax);
+      re_find_err = re_compile_pattern (n, (int) nsize, &e->pattern);
+      if (re_find_err)
+        {
+          free_regex (e);
+          return NULL;
+        }
+      /* Only the whole match is wanted, in registers of our own. */
+      e->pattern.regs_allocated = REGS_FIXED;
+      e->prefix_len = regex_prefix_len (n, nsize);
+      if (e->prefix_len > 0)
+        e->prefix = literal_new (n, e->prefix_len, syntax & RE_ICASE);
+      e->automaton = automaton_new (n, nsize, syntax & RE_ICASE);
+
+      if (i == REGEX_CACHE_SIZE)
+        free_regex (regex_cache[--i]);
+    }
+
+  memmove (regex_cache + 1, regex_cache, i * sizeof (*regex_cache));
+  regex_cache[0] = e;
+  return e;
+}
+
+// Return the number of compiled patterns reused from the cache, and
+// the number of patterns compiled in `*misses'.
+size_t
+regex_cache_hits (size_t *misses)
+{
+  *misses = regex_misses;
+  return regex_hits;
+}
+
+// Copy the `n' bytes of the text of `bp' at `o' to `dest'.
+static void
+copy_text (Buffer bp, size_t o, size_t n, char *dest)
+{
+  for (size_t len; n > 0; o += len, n -= len)
+    {
+      const char *s = get_buffer_segment (bp, o, &len);
+      len = MIN (len, n);
+      memcpy (dest, s, len);
+      dest += len;
+    }
+}
+
+/*
+ * Find the first match of `lp', of `n' bytes, in the text of `bp' that
+ * starts at or after `o' and before `limit', storing its offset in
+ * `match'.  Each segment of the text is searched in place; only the
+ * few bytes around the end of each one are copied to `window', of
+ * `2 * n' bytes, to find the matches that cross it.
+ */
+static bool
+find_literal_forward (Buffer bp, Literal lp, size_t n, size_t o, size_t limit, char *window,
+                      size_t *match)
+{
+  size_t size = MIN (limit + MAX (n, 1) - 1, get_buffer_size (bp));
+  for (size_t len; o < limit; o += len)
+    {
+      const char *s = get_buffer_segment (bp, o, &len);
+      len = MIN (len, size - o);
+      const char *p = literal_find (lp, s, len);
+      if (p != NULL)
+        {
+          *match = o + (p - s);
+          return true;
+        }
+
+      size_t start = o + len - MIN (len, n - 1), end = MIN (o + len + n - 1, size);
+      copy_text (bp, start, end - start, window);
+      p = literal_find (lp, window, end - start);
+      if (p != NULL && start + (p - window) < o + len)
+        {
+          *match = start + (p - window);
+          return true;
+        }
+    }
+  return false;
+}
+
+// Find the last match of `lp', of `n' bytes, in the text of `bp'
+// before `o' that starts at or after `limit', as find_literal_forward.
+static bool
+find_literal_backward (Buffer bp, Literal lp, size_t n, size_t o, size_t limit, size_t *match)
+{
+  char *window = (char *) xmalloc (2 * n);
+  for (size_t len; o > limit; o -= len)
+    {
+      const char *s = get_buffer_segment_before (bp, o, &len);
+      if (len > o - limit)
+        {
+          s += len - (o - limit);
+          len = o - limit;
+        }
+      const char *p = literal_rfind (lp, s, len);
+      if (p != NULL)
+        {
+          *match = o - len + (p - s);
+          return true;
+        }
+
+      size_t seg = o - len, start = seg - MIN (seg - limit, n - 1), end = seg + MIN (len, n - 1);
+      copy_text (bp, start, end - start, window);
+      p = literal_rfind (lp, window, end - start);
+      if (p != NULL && start + (p - window) + n > seg)
+        {
+          *match = start + (p - window);
+          return true;
+        }
+    }
+  return false;
+}
+
+/*
+ * Find the first match of `lp', the literal `s' of `n' bytes, as
+ * find_literal_forward, only in the runs of text where the trigram
+ * index of `bp' finds all the trigrams of `s'.
+ */
+static bool
+find_indexed_forward (Buffer bp, Literal lp, const char *s, size_t n, bool icase, size_t o,
+                      size_t limit, char *window, size_t *match)
+{
+  TrigramIndex ti = get_buffer_trigrams (bp);
+  for (size_t end; o < limit; o = end)
+    {
+      o = trigram_next (ti, o, s, n, icase, &end);
+      if (o < limit && find_literal_forward (bp, lp, n, o, MIN (end, limit), window, match))
+        return true;
+    }
+  return false;
+}
+
+// Find the last match of `lp' before `o', as find_indexed_forward.
+static bool
+find_indexed_backward (Buffer bp, Literal lp, const char *s, size_t n, bool icase, size_t o,
+                       size_t *match)
+{
+  TrigramIndex ti = get_buffer_trigrams (bp);
+  for (size_t start, end; trigram_prev (ti, o, s, n, icase, &start, &end); o = start + n - 1)
+    if (find_literal_backward (bp, lp, n, MIN (o, end + n - 1), start, match))
+      return true;
+    else if (start == 0)
+      break;
+  return false;
+}
+
+/*
+ * A forward search through more than `parallel-search-threshold' bytes
+ * is split into chunks of an eighth of that, which up to SEARCH_THREADS
+ * threads, the calling one among them, take in order.  The first match
+ * is in the first chunk that has one, so no chunk after it is taken.
+ * A literal is searched up to its length past the end of each chunk,
+ * for the matches that cross it.  A regexp is only split if it cannot
+ * match a newline, with its chunks starting at the start of a line, so
+ * that no match crosses them.  The threads only read the buffer, into
+ * space allocated beforehand, as they must not allocate from the
+ * collector.
+ */
+#define SEARCH_THREADS 8
+
+struct chunks
+{
+  pthread_mutex_t lock;
+  Buffer bp;
+  size_t o, size, chunk;          /* The text searched, in chunks of `chunk' bytes. */
+  size_t nchunks;
+  Literal lp;                     /* The literal, of `n' bytes, or NULL. */
+  size_t n;
+  char **windows;                 /* The window of each thread for `lp'. */
+  Automaton ap;                   /* The automaton of the regexp. */
+  size_t next;                    /* The first chunk not taken. */
+  size_t first;                   /* The first chunk with a match, or SIZE_MAX. */
+  size_t match;                   /* The match of `lp' in it. */
+};
+
+struct chunk_thread
+{
+  struct chunks *cp;
+  size_t thread;
+};
+
+// Return the first offset of the text of `bp' at or after `o' and
+// before `limit' at which a line starts, or `limit' if there is none.
+static size_t
+line_start (Buffer bp, size_t o, size_t limit)
+{
+  size_t len;
+  if (o == 0 || get_buffer_segment_before (bp, o, &len)[len - 1] == '\n')
+    return o;
+  for (; o < limit; o += len)
+    {
+      const char *s = get_buffer_segment (bp, o, &len);
+      const char *p = (const char *) memchr (s, '\n', MIN (len, limit - o));
+      if (p != NULL)
+        return o + (p - s) + 1;
+    }
+  return limit;
+}
+
+static void *
+search_chunks (void *arg)
+{
+  struct chunk_thread *tp = (struct chunk_thread *) arg;
+  struct chunks *cp = tp->cp;
+  pthread_mutex_lock (&cp->lock);
+  while (cp->next < cp->nchunks && cp->next < cp->first)
+    {
+      size_t k = cp->next++, match = 0;
+      pthread_mutex_unlock (&cp->lock);
+
+      /* A regexp is searched in the lines that start in the chunk. */
+      size_t start = cp->o + k * cp->chunk, end = MIN (start + cp->chunk, cp->size);
+      if (cp->lp == NULL && k > 0)
+        start = line_start (cp->bp, start, end);
+      bool found = start < end
+        && (cp->lp != NULL
+            ? find_literal_forward (cp->bp, cp->lp, cp->n, start, end, cp->windows[tp->thread],
+                                    &match)
+            : automaton_scan (cp->ap, tp->thread, cp->bp, start,
+                              line_start (cp->bp, end, cp->size)));
+      pthread_mutex_lock (&cp->lock);
+      if (found && k < cp->first)
+        {
+          cp->first = k;
+          cp->match = cp->lp != NULL ? match : start;
+        }
+    }
+  pthread_mutex_unlock (&cp->lock);
+  return NULL;
+}
+
+// Return the size of the chunks in which to search the text of `bp'
+// forwards from `o', or 0 if it is to be searched whole.
+static size_t
+search_chunk_size (Buffer bp, size_t o)
+{
+  long threshold;
+  if (!lisp_to_number (get_variable ("parallel-search-threshold"), &threshold)
+      || get_buffer_size (bp) - o <= (size_t) MAX (threshold, 0))
+    return 0;
+  return MAX (threshold / SEARCH_THREADS, 1);
+}
+
+/*
+ * Search the text of `bp' from `o' in chunks of `chunk' bytes for the
+ * literal `lp', of `n' bytes, or if it is NULL for the automaton `ap',
+ * storing in `match' the offset of the first match of `lp', or the
+ * start of the chunk in which the first match of `ap' is.
+ */
+static bool
+find_in_chunks (Buffer bp, size_t o, size_t chunk, Literal lp, size_t n, Automaton ap,
+                size_t *match)
+{
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t nthreads = MAX (MIN (cpus, SEARCH_THREADS), 1);
+  struct chunks c = {
+    .bp = bp, .o = o, .size = get_buffer_size (bp), .chunk = chunk,
+    .lp = lp, .n = n, .ap = ap, .first = SIZE_MAX
+  };
+  c.nchunks = (c.size - o + chunk - 1) / chunk;
+  pthread_mutex_init (&c.lock, NULL);
+
+  /* Make everything the threads use beforehand. */
+  if (lp != NULL)
+    {
+      c.windows = (char **) XCALLOC (nthreads, char *);
+      for (size_t i = 0; i < nthreads; i++)
+        c.windows[i] = (char *) xmalloc (2 * n);
+    }
+  else
+    automaton_threads (ap, nthreads);
+  struct chunk_thread *args = (struct chunk_thread *) XCALLOC (nthreads, struct chunk_thread);
+  pthread_t *threads = (pthread_t *) XCALLOC (nthreads, pthread_t);
+  eolscan_isa ();
+
+  /* Keep signals for the main thread. */
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  size_t started = 0;
+  for (size_t i = 1; i < nthreads; i++)
+    {
+      args[i] = (struct chunk_thread) { &c, i };
+      if (pthread_create (&threads[started], NULL, search_chunks, &args[i]) == 0)
+        started++;
+    }
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+  args[0] = (struct chunk_thread) { &c, 0 };
+  search_chunks (&args[0]);
+  for (size_t i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+  pthread_mutex_destroy (&c.lock);
+
+  *match = c.match;
+  return c.first != SIZE_MAX;
+}
+
+/* A window of the text of a buffer given to the regex library. */
+struct regex_window
+{
+  const char *s;                  /* The text, or NULL if there is none yet, */
+  size_t from, to;                /* from this offset to this one. */
+};
+
+/*
+ * Find the first match of `e' in the text of `bp' that starts at or
+ * after `o' and at or before `last', storing its bounds, relative to
+ * the window `w', in `regs'.  The text is given from the byte before
+ * `o', in windows of the whole lines after about SEARCH_WINDOW bytes
+ * if the regexp cannot match a newline, and else whole; `w' is kept
+ * for the next call while it holds `o'.  Fail, setting `re_find_err',
+ * if the text is more than the regex library can take.
+ */
+static bool
+regex_search_forward (struct regex_entry *e, Buffer bp, size_t o, size_t last,
+                      struct regex_window *w, struct re_registers *regs)
+{
+  size_t size = get_buffer_size (bp);
+  bool lines = e->automaton != NULL && !automaton_newline (e->automaton);
+  for (;;)
+    {
+      if (w->s == NULL || o >= w->to + (w->to == size))
+        {
+          w->from = o - MIN (o, 1);
+          w->to = lines && size - w->from > SEARCH_WINDOW
+            ? line_start (bp, w->from + SEARCH_WINDOW, size) : size;
+          if (w->to - w->from > INT_MAX)
+            {
+              w->s = NULL;
+              re_find_err = "The text is too big for the regex library";
+              return false;
+            }
+          w->s = get_buffer_contiguous (bp, w->from, w->to - w->from);
+        }
+
+      /* A start at the end of a window is left for the next one. */
+      size_t len = w->to - w->from, stop = MIN (w->to - (w->to < size), last);
+      e->pattern.not_bol = w->from > 0;
+      e->pattern.not_eol = w->to < size;
+      if (re_search_2 (&e->pattern, NULL, 0, w->s, (int) len, (int) (o - w->from),
+                       (int) (stop - o), regs, (int) len) >= 0)
+        return true;
+      if (w->to == size || last < w->to)
+        return false;
+      o = w->to;
+    }
+}
+
+/*
+ * Find the last match of `e' in `s', of `len' bytes, that starts at or
+ * after `min' and starts and ends at or before `o', storing it in
+ * `regs'.  Rather than trying every start from `o' backwards, the
+ * candidates are the occurrences of the literal prefix of the regexp,
+ * if it has one, found backwards and matched in turn; otherwise each
+ * chunk of SEARCH_CHUNK bytes from `o' backwards is searched forwards,
+ * keeping its last match.
+ */
+static bool
+find_regex_backward (struct regex_entry *e, const char *s, size_t len, size_t min, size_t o,
+                     struct re_registers *regs)
+{
+  if (e->prefix != NULL)
+    {
+      for (size_t end = o;;)
+        {
+          const char *p = end > min ? literal_rfind (e->prefix, s + min, end - min) : NULL;
+          if (p == NULL)
+            return false;
+          if (re_match_2 (&e->pattern, NULL, 0, s, (int) len, (int) (p - s), regs, (int) o) >= 0)
+            return true;
+          end = (p - s) + e->prefix_len - 1;
+        }
+    }
+
+  regoff_t match_start = -1, match_end = -1;
+  for (size_t cend = o + 1, cstart; cend > min && match_start < 0; cend = cstart)
+    {
+      cstart = cend - MIN (cend - min, SEARCH_CHUNK);
+      for (size_t i = cstart; i < cend; i = match_start + 1)
+        {
+          if (re_search_2 (&e->pattern, NULL, 0, s, (int) len, (int) i, (int) (cend - 1 - i),
+                           regs, (int) o) < 0)
+            break;
+          match_start = regs->start[0];
+          match_end = regs->end[0];
+        }
+    }
+  regs->start[0] = match_start;
+  regs->end[0] = match_end;
+  return match_start >= 0;
+}
+
+// Return the start of the line of the text of `bp' that holds `o'.
+static size_t
+line_start_before (Buffer bp, size_t o)
+{
+  for (size_t len; o > 0; o -= len)
+    {
+      const char *s = get_buffer_segment_before (bp, o, &len);
+      const char *p = eolscan_rfind (s, len, "\n");
+      if (p != NULL)
+        return o - len + (p - s) + 1;
+    }
+  return 0;
+}
+
+// Find the last match of `e' in the text of `bp' that starts and ends
+// at or before `o', as regex_search_forward, in windows of the whole
+// lines from about SEARCH_WINDOW bytes before `o' backwards.
+static bool
+regex_search_backward (struct regex_entry *e, Buffer bp, size_t o, struct regex_window *w,
+                       struct re_registers *regs)
+{
+  size_t size = get_buffer_size (bp);
+  bool lines = e->automaton != NULL && !automaton_newline (e->automaton);
+  for (;;)
+    {
+      size_t first = lines && o > SEARCH_WINDOW ? line_start_before (bp, o - SEARCH_WINDOW) : 0;
+      w->from = first - MIN (first, 1);
+      w->to = MIN (o + 1, size);
+      if (w->to - w->from > INT_MAX)
+        {
+          w->s = NULL;
+          re_find_err = "The text is too big for the regex library";
+          return false;
+        }
+      w->s = get_buffer_contiguous (bp, w->from, w->to - w->from);
+      e->pattern.not_bol = w->from > 0;
+      e->pattern.not_eol = w->to < size;
+      if (find_regex_backward (e, w->s, w->to - w->from, first - w->from, o - w->from, regs))
+        return true;
+      if (first == 0)
+        return false;
+      o = first - 1;
+    }
+}
 
-  memset (&pattern, 0, sizeof (pattern));
+/*
+ * Find the first match of `n' after `o' in the text of `bp', or if not
+ * `forward' the last one before `o', storing it in `out'.  A regexp is
+ * matched against the text with a byte of context on each side, so
+ * that anchors and word boundaries at `o' see the text around it.
+ */
+static bool
+find_substr (Buffer bp, size_t o, const char *n, size_t nsize,
+             bool forward, bool regex, bool icase, Region out)
+{
+  size_t size = get_buffer_size (bp), match;
 
-  //if (!regex)
-  // syntax |= RE_PLAIN;
+  /* A buffer with a trigram index is searched in the runs of text that
+     it finds, instead of in chunks. */
+  TrigramIndex ti = get_buffer_trigrams (bp);
+  if (!regex)
+    {
+      Literal lp = literal_new (n, nsize, icase);
+      size_t chunk = forward && nsize > 0 && ti == NULL ? search_chunk_size (bp, o) : 0;
+      char *window = (char *) xmalloc (2 * nsize);
+      if (!(chunk > 0 ? find_in_chunks (bp, o, chunk, lp, nsize, NULL, &match)
+            : ti != NULL ? (forward ? find_indexed_forward (bp, lp, n, nsize, icase, o, size,
+                                                            window, &match)
+                            : find_indexed_backward (bp, lp, n, nsize, icase, o, &match))
+            : forward ? find_literal_forward (bp, lp, nsize, o, size, window, &match)
+            : find_literal_backward (bp, lp, nsize, o, 0, &match)))
+        return false;
+      out->start = match;
+      out->end = match + nsize;
+      return true;
+    }
+
+  reg_syntax_t syntax = RE_SYNTAX_EMACS;
   if (icase)
     syntax |= RE_ICASE;
-  re_set_syntax (syntax);
-  search_regs.num_regs = 1;
-
-  re_find_err = re_compile_pattern (n, (int) nsize, &pattern);
-  pattern.not_bol = notbol;
-  pattern.not_eol = noteol;
-  size_t len = astr_len (as);
-  if (!re_find_err)
-    re_ret = re_search (&pattern, astr_cstr (as), (int) len,
-                        forward ? 0 : len, forward ? len : -len, &search_regs);
-
-  if (re_ret < 0)
+  struct regex_entry *e = compile_regex (n, nsize, syntax);
+  if (e == NULL)
+    return false;
+
+  /* A match only starts in the runs of text where the trigram index
+     finds its prefix, which are searched in turn up to their end. */
+  bool indexed = forward && ti != NULL && e->prefix != NULL;
+
+  /* The automaton reads the text in place. */
+  if (e->automaton != NULL && STREQ (get_variable ("regexp-engine"), "dfa"))
     {
-      *out = (struct Region){.start=-1, .end=-1};
-      return re_ret;
+      if (!forward)
+        return automaton_backward (e->automaton, bp, o, &out->start, &out->end);
+      if (indexed)
+        {
+          for (size_t last; o < size; o = last)
+            {
+              o = trigram_next (ti, o, n, e->prefix_len, icase, &last);
+              if (o < size && automaton_forward (e->automaton, bp, o, last,
+                                                 &out->start, &out->end))
+                return true;
+            }
+          return false;
+        }
+      size_t chunk = !automaton_newline (e->automaton) ? search_chunk_size (bp, o) : 0;
+      if (chunk > 0 && !find_in_chunks (bp, o, chunk, NULL, 0, e->automaton, &o))
+        return false;
+      return automaton_forward (e->automaton, bp, o, SIZE_MAX, &out->start, &out->end);
     }
 
-  const int delay = forward ? get_buffer_pt (global.cur_bp) : 0;
-
-  out->start = delay + search_regs.start[0];
-  out->end = delay + search_regs.end[0];
+  /* Match in windows of the text after `o', or before it. */
+  struct regex_window w = { NULL, 0, 0 };
+  regoff_t match_start, match_end;
+  struct re_registers search_regs = {
+    .num_regs = 1, .start = &match_start, .end = &match_end
+  };
+  if (!forward)
+    {
+      if (!regex_search_backward (e, bp, o, &w, &search_regs))
+        return false;
+    }
+  else
+    for (size_t last = size;; o = last)
+      {
+        if (indexed)
+          {
+            o = trigram_next (ti, o, n, e->prefix_len, icase, &last);
+            if (o >= size)
+              return false;
+            last = MIN (last, size);
+          }
+        if (regex_search_forward (e, bp, o, last, &w, &search_regs))
+          break;
+        if (last == size || re_find_err != NULL)
+          return false;
+      }
 
-  return re_ret;
+  out->start = w.from + match_start;
+  out->end = w.from + match_end;
+  return true;
 }
 
 static bool
@@ -104,16 +693,14 @@ search (const char *s, int forward, int regexp)
     return false;
 
   /* Attempt match. */
-  size_t o = get_buffer_pt (global.cur_bp);
   Region overlay = get_buffer_overlay (global.cur_bp);
-  bool notbol = forward ? o > 0 : false;
-  bool noteol = forward ? false : o < get_buffer_size (global.cur_bp);
-  const int ret = find_substr (forward ? get_buffer_post_point (global.cur_bp) : get_buffer_pre_point (global.cur_bp),
-                               s, ssize, forward, notbol, noteol, regexp,
-                               get_variable_bool ("case-fold-search") && no_upper (s, ssize, regexp),
-                               overlay);
-  if (ret < 0)
-    return false;
+  if (!find_substr (global.cur_bp, get_buffer_pt (global.cur_bp), s, ssize, forward, regexp,
+                    get_variable_bool ("case-fold-search") && no_upper (s, ssize, regexp),
+                    overlay))
+    {
+      *overlay = (struct Region){.start=-1, .end=-1};
+      return false;
+    }
 
   goto_offset (forward ? overlay->end : overlay->start);
 
@@ -139,7 +726,13 @@ do_search (bool forward, bool regexp, const_astr pattern)
       last_search = pattern;
 
       if (!search (astr_cstr (pattern), forward, regexp))
-        minibuf_error ("Search failed: \"%s\"", astr_cstr (pattern));
+        {
+          if (re_find_err != NULL)
+            minibuf_error ("%s", re_find_err);
+          else
+            minibuf_error ("Search failed: \"%s\"", astr_cstr (pattern));
+          re_find_err = NULL;
+        }
       else
         ok = leT;
     }
@@ -192,8 +785,31 @@ Search backward from point for match for regular expression REGEXP.
 END_DEFUN
 
 /*
- * Incremental search engine.
+ * Incremental search engine.  Each key that changes the search pushes
+ * the state it changed, so that @kbd{DEL} goes back to it without
+ * searching again.
  */
+struct isearch_state
+{
+  size_t len;                   /* The length of the pattern. */
+  size_t pt;                    /* Point. */
+  size_t cur;                   /* Where the search started from. */
+  struct Region match;          /* The match found. */
+  bool forward;
+  bool found;                   /* Whether the pattern was found. */
+};
+
+static void
+push_isearch_state (gl_list_t states, const_astr pattern, size_t cur, bool forward, bool found)
+{
+  struct isearch_state *s = XZALLOC (struct isearch_state);
+  *s = (struct isearch_state) {
+    .len = astr_len (pattern), .pt = get_buffer_pt (global.cur_bp), .cur = cur,
+    .match = *get_buffer_overlay (global.cur_bp), .forward = forward, .found = found,
+  };
+  gl_list_add_last (states, s);
+}
+
 static le *
 isearch (int forward, int regexp)
 {
@@ -205,6 +821,7 @@ isearch (int forward, int regexp)
   int last = true;
   astr pattern = astr_new ();
   size_t start = get_buffer_pt (global.cur_bp), cur = start;
+  gl_list_t states = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
   for (;;)
     {
       /* Make the minibuf message. */
@@ -231,6 +848,7 @@ isearch (int forward, int regexp)
       minibuf_write ("%s", astr_cstr (buf));
 
       int c = getkey (GETKEY_DEFAULT);
+      bool extend = false;
 
       if (c == KBD_CANCEL)
         {
@@ -249,11 +867,18 @@ isearch (int forward, int regexp)
         }
       else if (c == KBD_BS)
         {
-          if (astr_len (pattern) > 0)
+          size_t n = gl_list_size (states);
+          if (n > 0)
             {
-              astr_truncate (pattern, astr_len (pattern) - 1);
-              cur = start;
-              goto_offset (start);
+              /* Go back to the state before the last change. */
+              const struct isearch_state *s = gl_list_get_at (states, n - 1);
+              gl_list_remove_at (states, n - 1);
+              astr_truncate (pattern, s->len);
+              cur = s->cur;
+              forward = s->forward;
+              last = s->found;
+              *get_buffer_overlay (global.cur_bp) = s->match;
+              goto_offset (s->pt);
               global.thisflag |= FLAG_NEED_RESYNC;
             }
           else
@@ -262,10 +887,14 @@ isearch (int forward, int regexp)
       else if (c & KBD_CTRL && (c & 0xff) == 'q')
         {
           minibuf_write ("%s^Q-", astr_cstr (buf));
+          push_isearch_state (states, pattern, cur, forward, last);
           astr_cat_char (pattern, getkey_unfiltered (GETKEY_DEFAULT));
+          extend = true;
         }
       else if (c & KBD_CTRL && ((c & 0xff) == 'r' || (c & 0xff) == 's'))
         {
+          push_isearch_state (states, pattern, cur, forward, last);
+
           /* Invert direction. */
           if ((c & 0xff) == 'r')
             forward = false;
@@ -305,15 +934,33 @@ isearch (int forward, int regexp)
           break;
         }
       else
-        astr_cat_char (pattern, c);
+        {
+          push_isearch_state (states, pattern, cur, forward, last);
+          astr_cat_char (pattern, c);
+          extend = true;
+        }
 
-      if (astr_len (pattern) > 0)
+      /* A string one character longer can only match where the
+         string matched, so it is looked for from the last match on,
+         and not at all if that failed.  A regexp is searched again. */
+      size_t len = astr_len (pattern);
+      Region match = get_buffer_overlay (global.cur_bp);
+      if (c == KBD_BS)
+        ;
+      else if (len == 0)
+        last = true;
+      else if (extend && !regexp && len > 1 && !last)
+        ;
+      else if (extend && !regexp && len > 1)
         {
-          goto_offset (cur);
+          goto_offset (forward ? match->start : MIN (cur, match->start + len));
           last = search (astr_cstr (pattern), forward, regexp);
         }
       else
-        last = true;
+        {
+          goto_offset (cur);
+          last = search (astr_cstr (pattern), forward, regexp);
+        }
 
       if (global.thisflag & FLAG_NEED_RESYNC)
         {
@@ -404,6 +1051,17 @@ check_case (astr as)
   return i == astr_len (as);
 }
 
+// Return `repl' in the case of the text at `r'.
+static const_astr
+match_case (const_astr repl, Region r)
+{
+  int case_type = check_case (estr_get_as (get_buffer_region (global.cur_bp, r)));
+  if (case_type == 0)
+    return repl;
+  return astr_recase (astr_cpy (astr_new (), repl),
+                      case_type == 1 ? case_capitalized : case_upper);
+}
+
 DEFUN ("query-replace", query_replace)
 /*+
 Replace occurrences of a string with other text.
@@ -424,6 +1082,7 @@ what to do with it.
 
   bool noask = false;
   size_t count = 0;
+  gl_list_t edits = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
   while (search (astr_cstr (find), true, false))
     {
       int c = ' ';
@@ -455,19 +1114,22 @@ what to do with it.
           const_astr case_repl = repl;
           Region r = region_new (get_buffer_pt (global.cur_bp) - astr_len (find), get_buffer_pt (global.cur_bp));
           if (find_no_upper && get_variable_bool ("case-replace"))
+            case_repl = match_case (repl, r);
+
+          /* Without questions, the replacements are made in one go
+             once all the matches have been found. */
+          if (noask)
+            gl_list_add_last (edits, edit_new (get_region_start (r), astr_len (find),
+                                               estr_new_astr (case_repl)));
+          else
             {
-              int case_type = check_case (estr_get_as (get_buffer_region (global.cur_bp, r)));
-              if (case_type != 0)
-                case_repl = astr_recase (astr_cpy (astr_new (), repl),
-                                         case_type == 1 ? case_capitalized : case_upper);
+              Marker m = point_marker ();
+              goto_offset (get_region_start (r));
+              replace_estr (astr_len (find), estr_new_astr (case_repl));
+              goto_offset (get_marker_o (m));
+              unchain_marker (m);
             }
 
-          Marker m = point_marker ();
-          goto_offset (get_region_start (r));
-          replace_estr (astr_len (find), estr_new_astr (case_repl));
-          goto_offset (get_marker_o (m));
-          unchain_marker (m);
-
           if (c == '.')		/* Replace and quit. */
             break;
         }
@@ -478,6 +1140,7 @@ what to do with it.
           break;
         }
     }
+  replace_edits (edits);
 
   if (global.thisflag & FLAG_NEED_RESYNC)
     window_resync (global.cur_wp);
@@ -486,3 +1149,188 @@ what to do with it.
     minibuf_write ("Replaced %zu occurrences", count);
 }
 END_DEFUN
+
+/*
+ * Return the replacement `repl' for the regexp match in `s' whose
+ * groups are `regs': `\&' stands for the whole match, `\N' for group
+ * N and `\\' for a backslash.
+ */
+static astr
+expand_replacement (const_astr repl, const char *s, struct re_registers *regs)
+{
+  astr as = astr_new ();
+  const char *p = astr_cstr (repl), *end = p + astr_len (repl);
+  for (; p < end; p++)
+    {
+      size_t n = regs->num_regs;
+      if (*p == '\\' && p + 1 < end && p[1] == '&')
+        n = 0;
+      else if (*p == '\\' && p + 1 < end && p[1] >= '1' && p[1] <= '9')
+        n = p[1] - '0';
+      else if (*p == '\\' && p + 1 < end && p[1] == '\\')
+        {
+          astr_cat_char (as, *++p);
+          continue;
+        }
+      else
+        {
+          astr_cat_char (as, *p);
+          continue;
+        }
+
+      p++;
+      if (n < regs->num_regs && regs->start[n] >= 0)
+        astr_cat_nstr (as, s + regs->start[n], regs->end[n] - regs->start[n]);
+    }
+  return as;
+}
+
+/*
+ * Replace every match of `find' after point with `repl'.  All the
+ * matches are found first, and then replaced in one go, as a single
+ * change.
+ */
+static le *
+replace_all (const_astr find, const_astr repl, bool regexp)
+{
+  Buffer bp = global.cur_bp;
+  size_t nsize = astr_len (find), o = get_buffer_pt (bp), size = get_buffer_size (bp);
+  bool find_no_upper = no_upper (astr_cstr (find), nsize, regexp);
+  bool icase = get_variable_bool ("case-fold-search") && find_no_upper;
+  bool recase = find_no_upper && get_variable_bool ("case-replace");
+  gl_list_t edits = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+
+  if (!regexp)
+    {
+      Literal lp = literal_new (astr_cstr (find), nsize, icase);
+      char *window = (char *) xmalloc (2 * nsize);
+      for (size_t match; find_literal_forward (bp, lp, nsize, o, size, window, &match);
+           o = match + nsize)
+        {
+          Region r = region_new (match, match + nsize);
+          gl_list_add_last (edits, edit_new (match, nsize,
+                                             estr_new_astr (recase ? match_case (repl, r) : repl)));
+        }
+    }
+  else
+    {
+      reg_syntax_t syntax = RE_SYNTAX_EMACS;
+      if (icase)
+        syntax |= RE_ICASE;
+      struct regex_entry *e = compile_regex (astr_cstr (find), nsize, syntax);
+      if (e == NULL)
+        {
+          minibuf_error ("Invalid regexp: %s", re_find_err);
+          re_find_err = NULL;
+          return leNIL;
+        }
+      struct re_pattern_buffer *pattern = &e->pattern;
+
+      /* Match in the rest of the buffer, a window at a time. */
+      size_t nregs = pattern->re_nsub + 1;
+      struct regex_window w = { NULL, 0, 0 };
+      struct re_registers regs = {
+        .num_regs = nregs,
+        .start = (regoff_t *) XCALLOC (nregs, regoff_t),
+        .end = (regoff_t *) XCALLOC (nregs, regoff_t)
+      };
+      for (size_t i = o, last = SIZE_MAX;
+           i <= size && regex_search_forward (e, bp, i, size, &w, &regs);)
+        {
+          size_t ms = w.from + regs.start[0], me = w.from + regs.end[0];
+          i = ms == me ? me + 1 : me;
+
+          /* An empty match right after a match is not replaced. */
+          if (ms == me && ms == last)
+            continue;
+          last = me;
+
+          Region r = region_new (ms, me);
+          const_astr as = expand_replacement (repl, w.s, &regs);
+          gl_list_add_last (edits, edit_new (ms, me - ms,
+                                             estr_new_astr (recase ? match_case (as, r) : as)));
+        }
+      if (re_find_err)
+        {
+          minibuf_error ("%s", re_find_err);
+          re_find_err = NULL;
+          return leNIL;
+        }
+    }
+
+  size_t n = gl_list_size (edits), delta = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      const Edit ep = (const Edit) gl_list_get_at (edits, i);
+      delta += estr_len (ep->es, get_buffer_eol (bp)) - ep->del;
+    }
+  if (!replace_edits (edits))
+    return leNIL;
+
+  /* Leave point after the last replacement. */
+  if (n > 0)
+    {
+      const Edit ep = (const Edit) gl_list_get_at (edits, n - 1);
+      goto_offset (ep->o + ep->del + delta);
+    }
+  if (global.thisflag & FLAG_NEED_RESYNC)
+    window_resync (global.cur_wp);
+  minibuf_write ("Replaced %zu occurrences", n);
+  return leT;
+}
+
+DEFUN_ARGS ("replace-string", replace_string,
+            STR_ARG (find)
+            STR_ARG (repl))
+/*+
+Replace occurrences of @i{find} after point with @i{repl}.
+All the occurrences are replaced at once, as a single change that
+can be undone in one step.
++*/
+{
+  STR_INIT (find)
+  else
+    find = minibuf_read ("Replace string: ", "");
+  if (find == NULL)
+    return FUNCALL (keyboard_quit);
+  if (astr_len (find) == 0)
+    return leNIL;
+
+  STR_INIT (repl)
+  else
+    repl = minibuf_read ("Replace string %s with: ", "", astr_cstr (find));
+  if (repl == NULL)
+    return FUNCALL (keyboard_quit);
+
+  ok = replace_all (find, repl, false);
+}
+END_DEFUN
+
+DEFUN_ARGS ("replace-regexp", replace_regexp,
+            STR_ARG (find)
+            STR_ARG (repl))
+/*+
+Replace things after point matching regexp @i{find} with @i{repl}.
+In @i{repl}, `\\&' stands for the text matched, and `\\N' for the text
+matched by the Nth group of @i{find}.
+All the matches are replaced at once, as a single change that can be
+undone in one step.
++*/
+{
+  STR_INIT (find)
+  else
+    find = minibuf_read ("Replace regexp: ", "");
+  if (find == NULL)
+    return FUNCALL (keyboard_quit);
+  if (astr_len (find) == 0)
+    return leNIL;
+
+  STR_INIT (repl)
+  else
+    repl = minibuf_read ("Replace regexp %s with: ", "", astr_cstr (find));
+  if (repl == NULL)
+    return FUNCALL (keyboard_quit);
+
+  ok = replace_all (find, repl, true);
+}
+END_DEFUN
@@ -155,8 +155,9 @@ draw_line (size_t line, Window wp,
 static int
 calculate_highlight_region (Window wp, Region *rp)
 {
-  if ((wp != global.cur_wp
-       && !get_variable_bool ("highlight-nonselected-windows"))
+  if (get_buffer_large (get_window_bp (wp))
+      || (wp != global.cur_wp
+          && !get_variable_bool ("highlight-nonselected-windows"))
       || get_buffer_mark (get_window_bp (wp)) == NULL
       || !get_buffer_mark_active (get_window_bp (wp)))
     return false;
@@ -215,13 +216,14 @@ draw_status_line (size_t line, Window wp)
     eol_type = ":";
 
   term_move (line, 0);
-  size_t n = offset_to_line (bp, window_o (wp));
+  bool exact;
+  size_t n = estimate_offset_line (bp, window_o (wp), &exact);
 
   char screen_pos[4];   // Position
   make_screen_pos (screen_pos, wp);
 
   char line_col[STR_SIZE];
-  snprintf(line_col, STR_SIZE, "(%zu,%zu)", n + 1, get_goalc_bp (bp, window_o (wp)));
+  snprintf(line_col, STR_SIZE, "(%s%zu,%zu)", exact ? "" : "~", n + 1, get_goalc_bp (bp, window_o (wp)));
 
   astr as = astr_fmt ("--%s%2s  %-15s   %s %-9s (Fundamental",
                       eol_type, make_mode_line_flags (wp),
@@ -234,6 +236,13 @@ draw_status_line (size_t line, Window wp)
     astr_cat_cstr (as, " Def");
   if (get_buffer_isearch (bp))
     astr_cat_cstr (as, " Isearch");
+  if (get_buffer_large (bp))
+    astr_cat_cstr (as, " Large");
+  if (get_buffer_tail (bp))
+    astr_cat_cstr (as, " Tail");
+  if (get_buffer_loaded (bp) < get_buffer_size (bp))
+    astr_cat (as, astr_fmt (" Loading %d%%",
+                            (int) (100.0 * get_buffer_loaded (bp) / get_buffer_size (bp))));
 
   astr_cat_char (as, ')');
   term_addstr (astr_cstr (as));
@@ -259,8 +268,8 @@ draw_window (size_t topline, Window wp)
   size_t cur_tab_width = tab_width (bp);
 
   const size_t window_eheight = get_window_eheight (wp);
-  const bool linum_mode = get_variable_bool("linum-mode");
-  const size_t buffer_first_line = offset_to_line (bp, o);
+  const bool linum_mode = get_variable_bool("linum-mode") && !get_buffer_large (bp);
+  const size_t buffer_first_line = linum_mode ? offset_to_line (bp, o) : 0;
   size_t first_column = 0;
   size_t fill_column_indicator = 0;
 
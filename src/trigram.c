@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <string.h>
+#include "xalloc.h"
+#include "size_max.h"
+
+#include "main.h"
+#include "buffer.h"
+#include "trigram.h"
+
+#define WORDS ((1 << TRIGRAM_BITS) / 64) /* Words of the bitmap of a block. */
+#define MAX_QUERY 32                     /* Most trigrams of a string looked up. */
+
+struct TrigramIndex
+{
+  size_t blocks;     /* Number of blocks. */
+  size_t maxblocks;  /* Allocated blocks. */
+  size_t *start;     /* Offset of each block. */
+  bool *stale;       /* The block may hold trigrams no longer in it. */
+  uint64_t *bits;    /* The bitmap of each block, of WORDS words. */
+  size_t covered;    /* Size of the indexed prefix of the text. */
+  size_t size;       /* Size of the whole text. */
+  size_t nstale;     /* Number of stale blocks. */
+  double seconds;    /* Time spent indexing. */
+};
+
+// ================ Trigrams ===============================
+
+static inline uint32_t
+fold (unsigned char c)
+{
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static inline size_t
+hash (uint32_t trigram)
+{
+  return (uint32_t) (trigram * 2654435761u) >> (32 - TRIGRAM_BITS);
+}
+
+static inline bool
+has_hash (TrigramIndex ti, size_t b, size_t h)
+{
+  return (ti->bits[b * WORDS + h / 64] >> (h % 64)) & 1;
+}
+
+/*
+ * Store in `h' the hashes of up to MAX_QUERY trigrams of `s', and
+ * return their number, or 0 if the index cannot tell where `s' is: it
+ * is too short, or has bytes that may match others without case.
+ */
+static size_t
+query (const char *s, size_t n, bool icase, size_t *h)
+{
+  if (n < 3)
+    return 0;
+  size_t k = 0;
+  uint32_t t = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      if (icase && (unsigned char) s[i] >= 0x80)
+        return 0;
+      t = (t << 8 | fold (s[i])) & 0xffffff;
+      if (i >= 2 && k < MAX_QUERY)
+        h[k++] = hash (t);
+    }
+  return k;
+}
+
+// ================ Blocks =================================
+
+static size_t
+block_end (TrigramIndex ti, size_t b)
+{
+  return b + 1 < ti->blocks ? ti->start[b + 1] : ti->covered;
+}
+
+// Return the last block starting at or before `o'.
+static size_t
+block_at (TrigramIndex ti, size_t o)
+{
+  size_t lo = 0, hi = ti->blocks;
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (ti->start[mid] <= o)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+static void
+set_stale (TrigramIndex ti, size_t b, bool stale)
+{
+  ti->nstale += stale - ti->stale[b];
+  ti->stale[b] = stale;
+}
+
+static void
+reserve_blocks (TrigramIndex ti, size_t blocks)
+{
+  if (blocks > ti->maxblocks)
+    {
+      ti->maxblocks = MAX (blocks, ti->maxblocks * 2);
+      ti->start = xnrealloc (ti->start, ti->maxblocks, sizeof (size_t));
+      ti->stale = xnrealloc (ti->stale, ti->maxblocks, sizeof (bool));
+      ti->bits = xnrealloc (ti->bits, ti->maxblocks * WORDS, sizeof (uint64_t));
+    }
+}
+
+// Replace the blocks [first, last] by `n' uninitialised blocks.
+static void
+splice_blocks (TrigramIndex ti, size_t first, size_t last, size_t n)
+{
+  size_t tail = ti->blocks - (last + 1), blocks = first + n + tail;
+  for (size_t b = first; b <= last; b++)
+    set_stale (ti, b, false);
+  reserve_blocks (ti, blocks);
+  memmove (ti->start + first + n, ti->start + last + 1, tail * sizeof (size_t));
+  memmove (ti->stale + first + n, ti->stale + last + 1, tail * sizeof (bool));
+  memmove (ti->bits + (first + n) * WORDS, ti->bits + (last + 1) * WORDS,
+           tail * WORDS * sizeof (uint64_t));
+  memset (ti->stale + first, 0, n * sizeof (bool));
+  ti->blocks = blocks;
+}
+
+// Add to block `b' the trigrams of `bp' that start in [from, to).
+static void
+add_trigrams (TrigramIndex ti, Buffer bp, size_t b, size_t from, size_t to)
+{
+  uint64_t *bits = ti->bits + b * WORDS;
+  size_t end = MIN (to + 2, get_buffer_size (bp));
+  uint32_t t = 0;
+  for (size_t o = from, len; o < end; o += len)
+    {
+      const unsigned char *s = (const unsigned char *) get_buffer_segment (bp, o, &len);
+      len = MIN (len, end - o);
+      for (size_t i = 0; i < len; i++)
+        {
+          t = (t << 8 | fold (s[i])) & 0xffffff;
+          if (o + i >= from + 2)
+            {
+              size_t h = hash (t);
+              bits[h / 64] |= (uint64_t) 1 << (h % 64);
+            }
+        }
+    }
+}
+
+// Index the text of block `b' from scratch.
+static void
+fill_block (TrigramIndex ti, Buffer bp, size_t b)
+{
+  memset (ti->bits + b * WORDS, 0, WORDS * sizeof (uint64_t));
+  add_trigrams (ti, bp, b, ti->start[b], block_end (ti, b));
+}
+
+/*
+ * Index the stale block `b' again, splitting it if edits made it much
+ * bigger than TRIGRAM_BLOCK, or dropping it if they emptied it.
+ */
+static void
+refill_block (TrigramIndex ti, Buffer bp, size_t b)
+{
+  size_t start = ti->start[b], size = block_end (ti, b) - start;
+  size_t n = size / TRIGRAM_BLOCK;
+  if (size <= 2 * TRIGRAM_BLOCK)
+    n = (size > 0 || ti->blocks == 1) ? 1 : 0;
+
+  splice_blocks (ti, b, b, n);
+  for (size_t i = 0; i < n; i++)
+    ti->start[b + i] = start + size * i / n;
+  for (size_t i = 0; i < n; i++)
+    fill_block (ti, bp, b + i);
+}
+
+// Index a new block at the end of the indexed prefix.
+static void
+extend (TrigramIndex ti, Buffer bp)
+{
+  size_t size = get_buffer_size (bp);
+  size_t end = size - ti->covered < 2 * TRIGRAM_BLOCK ? size : ti->covered + TRIGRAM_BLOCK;
+  reserve_blocks (ti, ti->blocks + 1);
+  ti->start[ti->blocks] = ti->covered;
+  ti->stale[ti->blocks] = false;
+  ti->blocks++;
+  ti->covered = end;
+  ti->size = size;
+  fill_block (ti, bp, ti->blocks - 1);
+}
+
+/*
+ * Return whether a match of a string of `n' bytes with the trigram
+ * hashes `h' may start in block `b': its trigrams start up to `n - 3'
+ * bytes past the end of the block, so the blocks up to there are
+ * looked up too.
+ */
+static bool
+candidate (TrigramIndex ti, size_t b, size_t n, const size_t *h, size_t k)
+{
+  size_t reach = block_end (ti, b) + n - 3;
+  if (reach > ti->covered && ti->covered < ti->size)
+    return true;
+  for (size_t i = 0; i < k; i++)
+    {
+      bool found = false;
+      for (size_t j = b; !found && j < ti->blocks && (j == b || ti->start[j] < reach); j++)
+        found = has_hash (ti, j, h[i]);
+      if (!found)
+        return false;
+    }
+  return true;
+}
+
+// ================ Public ================================
+
+TrigramIndex
+trigram_new (void)
+{
+  return XZALLOC (struct TrigramIndex);
+}
+
+/*
+ * Update the index after `del' bytes at `o' have been replaced by
+ * `len' bytes.  The blocks after the edit are moved, and the trigrams
+ * that start in the new text, or just before it, are added to the
+ * blocks where they start, which are left stale.  An edit past the
+ * indexed prefix is left for the next extension, and one straddling
+ * its end cuts the prefix back.
+ */
+void
+trigram_update (TrigramIndex ti, Buffer bp, size_t o, size_t del, size_t len)
+{
+  if (ti->blocks == 0 || (del == 0 && len == 0))
+    return;
+  ti->size = ti->size - del + len;
+  if (o >= ti->covered + 2)
+    return;
+
+  if (o <= ti->covered)
+    {
+      size_t b = block_at (ti, o);
+      if (o + del > ti->covered)
+        {
+          for (size_t j = b; j < ti->blocks; j++)
+            set_stale (ti, j, false);
+          ti->covered = ti->start[b];
+          ti->blocks = b;
+        }
+      else
+        {
+          for (size_t j = b + 1; j < ti->blocks; j++)
+            if (ti->start[j] <= o + del)
+              {
+                ti->start[j] = o + len;
+                set_stale (ti, j, true);
+              }
+            else
+              ti->start[j] = ti->start[j] - del + len;
+          ti->covered = ti->covered - del + len;
+          set_stale (ti, b, true);
+        }
+    }
+
+  /* The trigrams that start before the edit and end in it are new too. */
+
+  for (size_t p = o - MIN (o, 2), end = MIN (o + len, ti->covered); p < end;)
+    {
+      size_t b = block_at (ti, p), to = MIN (end, block_end (ti, b));
+      add_trigrams (ti, bp, b, p, to);
+      set_stale (ti, b, true);
+      p = to;
+    }
+}
+
+/*
+ * Index one more block of the text, or failing that a stale block
+ * again.  Return false if the index is up to date.
+ */
+bool
+trigram_advance (TrigramIndex ti, Buffer bp)
+{
+  size_t b = 0;
+  if (ti->covered == get_buffer_size (bp) && ti->blocks > 0)
+    {
+      if (ti->nstale == 0)
+        return false;
+      while (!ti->stale[b])
+        b++;
+    }
+
+  struct timeval t0, t1;
+  gettimeofday (&t0, NULL);
+  if (ti->covered < get_buffer_size (bp) || ti->blocks == 0)
+    extend (ti, bp);
+  else
+    refill_block (ti, bp, b);
+  gettimeofday (&t1, NULL);
+  ti->seconds += (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  return true;
+}
+
+/*
+ * Return the first offset from `o' at which a match of `s', of `n'
+ * bytes, may start, storing in `end' the end of the run of text from
+ * there in which the index finds all its trigrams, or SIZE_MAX if it
+ * runs past the indexed prefix.
+ */
+size_t
+trigram_next (TrigramIndex ti, size_t o, const char *s, size_t n, bool icase, size_t *end)
+{
+  size_t h[MAX_QUERY], k = query (s, n, icase, h);
+  *end = SIZE_MAX;
+  if (k == 0 || o >= ti->covered)
+    return o;
+
+  for (size_t b = block_at (ti, o); b < ti->blocks; b++)
+    if (block_end (ti, b) > o && candidate (ti, b, n, h, k))
+      {
+        size_t from = MAX (o, ti->start[b]);
+        while (b + 1 < ti->blocks && candidate (ti, b + 1, n, h, k))
+          b++;
+        if (b + 1 < ti->blocks)
+          *end = block_end (ti, b);
+        return from;
+      }
+  return ti->covered;
+}
+
+/*
+ * Find the last run of text that may hold the start of a match of
+ * `s', of `n' bytes, that ends at or before `o', storing its bounds in
+ * `start' and `end'.  Return false if there is none.
+ */
+bool
+trigram_prev (TrigramIndex ti, size_t o, const char *s, size_t n, bool icase,
+              size_t *start, size_t *end)
+{
+  if (o < n)
+    return false;
+  size_t h[MAX_QUERY], k = query (s, n, icase, h), limit = o - n + 1;
+  *start = 0;
+  *end = limit;
+  if (k == 0)
+    return true;
+
+  /* The text past the indexed prefix may hold anything. */
+  bool run = limit > ti->covered;
+  if (run)
+    *start = ti->covered;
+  for (size_t b = run ? ti->blocks : block_at (ti, limit - 1) + 1; b > 0; b--)
+    {
+      size_t c = b - 1;
+      if (ti->start[c] == block_end (ti, c))
+        continue;
+      if (candidate (ti, c, n, h, k))
+        {
+          if (!run)
+            *end = MIN (limit, block_end (ti, c));
+          run = true;
+          *start = ti->start[c];
+        }
+      else if (run)
+        return true;
+    }
+  return run;
+}
+
+// Return the size of the indexed prefix of the text.
+size_t
+trigram_covered (TrigramIndex ti)
+{
+  return ti->covered;
+}
+
+// Return the memory taken by the index.
+size_t
+trigram_bytes (TrigramIndex ti)
+{
+  return sizeof (*ti)
+    + ti->maxblocks * (sizeof (size_t) + sizeof (bool) + WORDS * sizeof (uint64_t));
+}
+
+// Return the number of blocks left to index again after edits.
+size_t
+trigram_stale (TrigramIndex ti)
+{
+  return ti->nstale;
+}
+
+// Return the time spent building the index, in seconds.
+double
+trigram_seconds (TrigramIndex ti)
+{
+  return ti->seconds;
+}
@@ -0,0 +1,57 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+/*
+ * Copyright (C) 2019  Jimmy Aguilar Mena
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "main.h"
+
+/*
+ * The trigram index splits the buffer text in blocks of about
+ * TRIGRAM_BLOCK bytes and keeps for each a set of the hashes of the
+ * trigrams starting in it, folded to ASCII lower case, in a bitmap of
+ * 2^TRIGRAM_BITS bits.  A search for a string of three bytes or more
+ * then only needs to look at the blocks that hold all its trigrams.
+ *
+ * As with the line index, only a prefix of the text is indexed, which
+ * is extended while the editor waits for keys.  An edit adds the
+ * trigrams it makes to the block it falls in, which keeps the sets
+ * whole but leaves the trigrams it removed; such blocks are indexed
+ * again while the editor waits.
+ *
+ * The index only reads its own memory when asked for candidates, so
+ * several threads may do so at once, as long as the buffer is not
+ * edited meanwhile.
+ */
+
+#define TRIGRAM_BLOCK (1024 * 1024) /* Size of the blocks of a new index. */
+#define TRIGRAM_BITS  16            /* Bits of the hash of a trigram. */
+
+typedef struct TrigramIndex *TrigramIndex;
+
+TrigramIndex trigram_new (void);
+void trigram_update (TrigramIndex ti, Buffer bp, size_t o, size_t del, size_t len);
+bool trigram_advance (TrigramIndex ti, Buffer bp);
+size_t trigram_next (TrigramIndex ti, size_t o, const char *s, size_t n, bool icase, size_t *end);
+bool trigram_prev (TrigramIndex ti, size_t o, const char *s, size_t n, bool icase,
+                   size_t *start, size_t *end);
+_GL_ATTRIBUTE_PURE size_t trigram_covered (TrigramIndex ti);
+_GL_ATTRIBUTE_PURE size_t trigram_bytes (TrigramIndex ti);
+_GL_ATTRIBUTE_PURE size_t trigram_stale (TrigramIndex ti);
+_GL_ATTRIBUTE_PURE double trigram_seconds (TrigramIndex ti);
+
+#endif
@@ -54,7 +54,10 @@ undo_save (void *type, size_t o, size_t osize, size_t size)
   if (type == undo_save_block)
     {
       up->size = size;
-      up->text = get_buffer_region (global.cur_bp, region_new (o, o + osize));
+      /* In large-file mode, do not copy huge deletions: the delta
+         without text stops undo there instead. */
+      if (!get_buffer_large (global.cur_bp) || osize <= LARGE_FILE_UNDO_LIMIT)
+        up->text = get_buffer_region (global.cur_bp, region_new (o, o + osize));
       up->unchanged = !get_buffer_modified (global.cur_bp);
     }
 
@@ -94,6 +97,25 @@ undo_save_block (size_t o, size_t osize, size_t size)
   undo_save (undo_save_block, o, osize, size);
 }
 
+// Return true if `up', or any change of the sequence it ends, is too
+// large to undo; then none of it is undone.
+static bool
+undo_lost (Undo up)
+{
+  for (size_t depth = 0; up != NULL; up = up->next)
+    {
+      if (up->type == undo_save_block && up->text == NULL)
+        return true;
+      if (up->type == undo_end_sequence)
+        depth++;
+      else if (up->type == undo_start_sequence && depth > 0)
+        depth--;
+      if (depth == 0)
+        return false;
+    }
+  return false;
+}
+
 /*
  * Revert an action.  Return the next undo entry.
  */
@@ -101,8 +123,12 @@ static Undo
 revert_action (Undo up)
 {
   if (up->type == undo_end_sequence)
-    for (up = up->next; up->type != undo_start_sequence; up = revert_action (up))
-      ;
+    {
+      for (up = up->next; up != NULL && up->type != undo_start_sequence; up = revert_action (up))
+        ;
+      if (up == NULL)
+        return NULL;
+    }
 
   if (up->type != undo_end_sequence)
     goto_offset (up->o);
@@ -129,7 +155,8 @@ Repeat this command to undo more changes.
   if (warn_if_readonly_buffer ())
     return leNIL;
 
-  if (get_buffer_next_undop (global.cur_bp) == NULL)
+  if (get_buffer_next_undop (global.cur_bp) == NULL
+      || undo_lost (get_buffer_next_undop (global.cur_bp)))
     {
       minibuf_error ("No further undo information");
       set_buffer_next_undop (global.cur_bp, get_buffer_last_undop (global.cur_bp));
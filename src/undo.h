@@ -27,10 +27,12 @@ struct Undo
   size_t o;        /* Buffer offset of the undo delta. */
   bool unchanged;  /* Flag indicating that reverting this undo leaves
                       the buffer in an unchanged state. */
-  estr text;       /* Old text. */
+  estr text;       /* Old text, or NULL if it was too large to keep. */
   size_t size;     /* Size of replacement text. */
 };
 
+/* Largest change that can be undone in large-file mode. */
+#define LARGE_FILE_UNDO_LIMIT (1024 * 1024)
 
 extern bool undo_nosave;
 void undo_start_sequence (void);
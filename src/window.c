@@ -310,7 +310,8 @@ window_o (Window wp)
 bool
 window_top_visible (Window wp)
 {
-  return offset_to_line (get_window_bp (wp), window_o (wp)) == get_window_topdelta (wp);
+  bool exact;
+  return estimate_offset_line (get_window_bp (wp), window_o (wp), &exact) == get_window_topdelta (wp);
 }
 
 bool
@@ -322,7 +323,8 @@ window_bottom_visible (Window wp)
 void
 window_resync (Window wp)
 {
-  size_t n = offset_to_line (wp->bp, get_buffer_pt (wp->bp));
+  bool exact;
+  size_t n = estimate_offset_line (wp->bp, get_buffer_pt (wp->bp), &exact);
   ptrdiff_t delta = n - wp->lastpointn;
 
   if (delta)
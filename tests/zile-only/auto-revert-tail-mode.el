@@ -0,0 +1,10 @@
+; Edit a buffer following its file, which is not updated meanwhile.
+(auto-revert-tail-mode)
+(end-of-buffer)
+(insert "tail")
+(auto-revert-tail-mode)
+(beginning-of-buffer)
+(kill-line)
+(auto-revert-tail-mode)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,15 @@
+; Follow a file stored as a rope when it is truncated and written
+; again, as by copytruncate log rotation, and then as it grows.
+; Turning the mode on brings the buffer up to date.
+(setq rope-threshold "10")
+(auto-revert-tail-mode)
+(shell-command "cp auto-revert-tail-mode_follow.input rotated; echo Rotated. > auto-revert-tail-mode_follow.input")
+(auto-revert-tail-mode)
+(auto-revert-tail-mode)
+(shell-command "echo Grown. >> auto-revert-tail-mode_follow.input; rm rotated")
+(auto-revert-tail-mode)
+(auto-revert-tail-mode)
+(end-of-buffer)
+(insert "End.")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,15 @@
+; Search with a trigram index, before and after edits that it follows.
+(buffer-index-status t)
+(search-forward "several")
+(insert "1")
+(search-backward "sample")
+(insert "2")
+(end-of-buffer)
+(insert "A new paragraph.")
+(search-backward "new par")
+(insert "3")
+(beginning-of-buffer)
+(search-forward-regexp "para+graph")
+(insert "4")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,26 @@
+; Search with a trigram index whose first run of blocks has the prefix
+; of the regexp but no match, with both matchers, and list the matches.
+(shell-command "printf 'para\nSTART\n'; yes xxxxxxxxxxxxxxx | head -n 300000; printf 'END\nparaaagraph\n'" t)
+(buffer-index-status t)
+(beginning-of-buffer)
+(search-forward-regexp "para+graph")
+(insert "4")
+(setq regexp-engine "regex")
+(beginning-of-buffer)
+(search-forward-regexp "para+graph\.")
+(insert "5")
+(occur "para+graph")
+(beginning-of-buffer)
+(search-forward "START")
+(set-mark (point))
+(search-forward "END")
+(delete-region (point) (mark))
+(other-window 1)
+(set-mark (point))
+(end-of-buffer)
+(copy-region-as-kill (point) (mark))
+(other-window -1)
+(end-of-buffer)
+(yank)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,15 @@
+; Visit the file mapped into memory, edit it and save it over the mapping.
+(kill-buffer "find-file-read-only_edit.input")
+(find-file-read-only "find-file-read-only_edit.input")
+(toggle-read-only)
+(goto-line 3)
+(insert "a")
+(end-of-buffer)
+(backward-delete-char 1)
+(beginning-of-buffer)
+(kill-line)
+(search-forward "lines")
+(forward-line 1)
+(insert "b")
+(save-buffer)
+(save-buffers-kill-emacs)
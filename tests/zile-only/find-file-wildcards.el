@@ -0,0 +1,10 @@
+; Visit the file again through a pattern matching its name.
+(goto-line 2)
+(kill-line)
+(save-buffer)
+(kill-buffer "find-file-wildcards.input")
+(find-file "find-file-wildcards.inp?t")
+(end-of-buffer)
+(insert "a")
+(save-buffer)
+(save-buffers-kill-emacs)
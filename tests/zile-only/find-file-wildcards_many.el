@@ -0,0 +1,14 @@
+; Visit several files through a pattern, so that they are read by the
+; preloading threads, then again after killing one of them.
+(shell-command "echo One. > find-file-wildcards_many.1; echo Two. > find-file-wildcards_many.2; echo Three. > find-file-wildcards_many.3")
+(find-file "find-file-wildcards_many.[0-9]")
+(kill-buffer "find-file-wildcards_many.2")
+(find-file "find-file-wildcards_many.[0-9]")
+(shell-command "rm find-file-wildcards_many.[0-9]")
+(switch-to-buffer "find-file-wildcards_many.input")
+(end-of-buffer)
+(insert-buffer "find-file-wildcards_many.3")
+(insert-buffer "find-file-wildcards_many.2")
+(insert-buffer "find-file-wildcards_many.1")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,10 @@
+; A file visited as a rope is read, not mapped, so that the buffer
+; keeps its text when the file is then truncated by another program.
+(setq rope-threshold "10")
+(kill-buffer "find-file_rope-truncated.input")
+(find-file "find-file_rope-truncated.input")
+(shell-command ": > find-file_rope-truncated.input")
+(end-of-buffer)
+(insert "End.")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,2 @@
+; isearch-forward s C-s BACKSPACE e RET X save-buffer save-buffers-kill-emacs
+(execute-kbd-macro "\C-ss\C-s\BACKSPACEe\rX\C-x\C-s\C-x\C-c")
@@ -0,0 +1,17 @@
+; Edit the buffer in large-file mode, undoing some changes.
+(large-file-mode)
+(goto-line 3)
+(insert "a")
+(next-line 1)
+(set-mark (point))
+(forward-line 2)
+(kill-region (mark) (point))
+(undo)
+(end-of-buffer)
+(previous-line 2)
+(insert "b")
+(large-file-mode)
+(beginning-of-buffer)
+(kill-line)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,56 @@
+; Edit across the boundaries of the line index blocks: double the
+; text until it is over 16 KiB, then kill and yank across them,
+; going to a line after each edit.
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(mark-whole-buffer)
+(copy-region-as-kill (point) (mark))
+(end-of-buffer)
+(yank)
+(goto-line 400)
+(insert "1")
+(goto-char 8000)
+(set-mark (point))
+(goto-char 8400)
+(kill-region (point) (mark))
+(goto-line 400)
+(insert "2")
+(goto-char 100)
+(set-mark (point))
+(goto-char 12000)
+(kill-region (point) (mark))
+(goto-line 40)
+(insert "3")
+(goto-char 8100)
+(yank)
+(yank)
+(goto-line 700)
+(insert "4")
+(save-buffer)
+(save-buffers-kill-emacs)
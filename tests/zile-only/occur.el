@@ -0,0 +1,13 @@
+; List the lines with a match, copy the list, and go to the second.
+(occur "[a-z]+ [lp]")
+(other-window 1)
+(set-mark (point))
+(end-of-buffer)
+(copy-region-as-kill (point) (mark))
+(goto-line 3)
+(occur-mode-goto-occurrence)
+(insert "*")
+(end-of-buffer)
+(yank)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,14 @@
+; List a line longer than the text kept of it, whose cut falls inside
+; a two-byte character: the character is left out.
+(end-of-buffer)
+(shell-command "printf '%0511d\303\251 tail\n' 0" t)
+(occur "tail")
+(other-window 1)
+(set-mark (point))
+(end-of-buffer)
+(copy-region-as-kill (point) (mark))
+(other-window -1)
+(end-of-buffer)
+(yank)
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,13 @@
+; Search forwards in chunks of a byte: a string that crosses chunks,
+; and regexps that start further down, on lines of their own.
+(setq parallel-search-threshold "8")
+(search-forward "sample file")
+(insert "1")
+(search-forward-regexp "\<[a-z]+ lines")
+(insert "2")
+(search-forward-regexp "^$")
+(insert "3")
+(search-forward-regexp "one \| para")
+(insert "4")
+(save-buffer)
+(save-buffers-kill-emacs)
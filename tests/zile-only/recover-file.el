@@ -0,0 +1,15 @@
+; Edit the file, then visit it afresh with the edits replayed from its journal.
+(goto-line 3)
+(insert "a")
+(kill-line)
+(forward-line 2)
+(set-mark (point))
+(forward-line 3)
+(kill-region (mark) (point))
+(end-of-buffer)
+(yank)
+(beginning-of-buffer)
+(delete-char 5)
+(recover-file "recover-file.input")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,9 @@
+; A journal applies to the file as it was visited: once the file has
+; been changed on disk, its edits are not replayed on it.
+(shell-command "echo Replaced. > recover-file_changed.input")
+(insert "a")
+(recover-file "recover-file_changed.input")
+(end-of-buffer)
+(insert " Saved.")
+(save-buffer)
+(save-buffers-kill-emacs)
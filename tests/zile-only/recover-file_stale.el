@@ -0,0 +1,13 @@
+; A journal left by an editor that died is kept when the file is
+; visited again and edited, and after its edits are replayed, until
+; the file is saved.
+(shell-command "printf 'zile journal %s %s\n0 4 7\nThat is' $(stat -c '%s %.9Y' recover-file_stale.input) > '#recover-file_stale.input.journal#'")
+(kill-buffer "recover-file_stale.input")
+(find-file "recover-file_stale.input")
+(insert "x")
+(undo)
+(recover-file "recover-file_stale.input")
+(end-of-buffer)
+(shell-command "tail -n +2 '#recover-file_stale.input.journal#'" t)
+(save-buffer)
+(save-buffers-kill-emacs)
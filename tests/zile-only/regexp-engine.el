@@ -0,0 +1,14 @@
+; Find the longest of the matches that start first, forwards and
+; backwards, with the automaton and then with the regex library.
+(search-forward-regexp "a\|a sample")
+(insert "1")
+(search-backward-regexp "[a-z]+ ")
+(insert "2")
+(setq regexp-engine "regex")
+(forward-line)
+(search-forward-regexp "a\|a sample")
+(insert "3")
+(search-backward-regexp "[a-z]+ ")
+(insert "4")
+(save-buffer)
+(save-buffers-kill-emacs)
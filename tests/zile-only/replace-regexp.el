@@ -0,0 +1,8 @@
+; Replace the matches of a regexp, using its groups, then undo it.
+(forward-line)
+(replace-regexp "\([a-z]*\)e\b" "<\1|\&>")
+(insert "X")
+(replace-regexp "^" "> ")
+(undo)
+(save-buffer)
+(save-buffers-kill-emacs)
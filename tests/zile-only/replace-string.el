@@ -0,0 +1,6 @@
+; Replace a string in the rest of the buffer, following its case.
+(forward-line)
+(replace-string "it" "that")
+(insert "X")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,6 @@
+; Match a regexp anchored at the start of the line point is on.
+(forward-line)
+(search-forward-regexp "^It")
+(insert "X")
+(save-buffer)
+(save-buffers-kill-emacs)
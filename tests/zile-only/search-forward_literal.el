@@ -0,0 +1,8 @@
+; Search for strings containing regexp special characters.
+(search-forward "e.")
+(insert "X")
+(search-forward "s.")
+(search-backward "e.")
+(insert "Y")
+(save-buffer)
+(save-buffers-kill-emacs)
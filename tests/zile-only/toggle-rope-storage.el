@@ -0,0 +1,14 @@
+; Edit the buffer stored as a rope, then as a gap buffer again.
+(toggle-rope-storage)
+(goto-line 3)
+(insert "a")
+(end-of-buffer)
+(backward-delete-char 1)
+(beginning-of-buffer)
+(kill-line)
+(search-forward "lines")
+(toggle-rope-storage)
+(forward-line 1)
+(insert "b")
+(save-buffer)
+(save-buffers-kill-emacs)
@@ -0,0 +1,13 @@
+; Undo a command that made a change too large to record in large-file
+; mode and then others: it is left whole rather than half undone.
+(shell-command "yes Here is a sample file. | head -n 50000" t)
+(large-file-mode)
+(beginning-of-buffer)
+(set-mark (point))
+(goto-line 50001)
+(execute-kbd-macro "\C-wb")
+(undo)
+(end-of-buffer)
+(insert "c")
+(save-buffer)
+(save-buffers-kill-emacs)